@@ -0,0 +1,334 @@
+﻿#include "opencv2/opencv.hpp"
+#include "opencv2/core/core.hpp"
+#include "iostream"
+#include "fstream"
+#include <string.h>
+#include <functional>
+#ifdef _WIN32
+#include "Windows.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "Archive.h"
+#include "ImageCodec.h"
+
+static const char ARCHIVE_MAGIC[4] = { 'I', 'C', 'A', 'R' };
+static const size_t FOOTER_SIZE = 16; // 索引偏移(8) | 条目数(4) | 魔数(4)
+
+// 解析尾部，得到索引的位置和条目数
+static bool ReadFooter(const char* footer, uint64_t fileSize, uint64_t& indexOffset, uint32_t& count)
+{
+	if (memcmp(footer + 12, ARCHIVE_MAGIC, 4) != 0)
+		return false;
+	memcpy(&indexOffset, footer, 8);
+	memcpy(&count, footer + 8, 4);
+
+	return indexOffset <= fileSize - FOOTER_SIZE;
+}
+
+static bool ParseIndex(const char* p, size_t len, uint32_t count, vector<ArchiveEntry>& entries)
+{
+	size_t pos = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		ArchiveEntry e;
+		uint32_t nameLen;
+		if (pos + 4 > len)
+			return false;
+		memcpy(&nameLen, p + pos, 4);
+		pos += 4;
+		if (pos + nameLen + 24 > len)
+			return false;
+		e.name.assign(p + pos, nameLen);
+		pos += nameLen;
+		memcpy(&e.offset, p + pos, 8);
+		memcpy(&e.size, p + pos + 8, 4);
+		memcpy(&e.channel, p + pos + 12, 4);
+		memcpy(&e.rows, p + pos + 16, 4);
+		memcpy(&e.cols, p + pos + 20, 4);
+		pos += 24;
+		entries.push_back(e);
+	}
+
+	return pos == len; // 索引后面紧接着就是尾部
+}
+
+// 按偏移读一段文件内容
+typedef function<bool(uint64_t offset, size_t len, char* out)> ReadAt;
+
+// 从文件末尾往前找最后一个完整的 索引+尾部，end 为该尾部的结束位置
+// 正常关闭的归档就在文件末尾；追加中途退出时，尾部后面是没写完的数据，跳过它们找前一次的尾部
+static bool LocateIndex(uint64_t fileSize, const ReadAt& read, uint64_t& end, uint64_t& indexOffset, vector<ArchiveEntry>& entries)
+{
+	const size_t CHUNK = 1 << 16;
+	vector<char> chunk(CHUNK + 3);
+	uint64_t chunkEnd = fileSize;
+	while (chunkEnd >= FOOTER_SIZE)
+	{
+		// 相邻两块重叠3字节，跨块的魔数也能找到
+		uint64_t chunkStart = chunkEnd > CHUNK ? chunkEnd - CHUNK : 0;
+		size_t len = (size_t)(chunkEnd - chunkStart);
+		if (!read(chunkStart, len, chunk.data()))
+			return false;
+		for (size_t i = len; i >= 4; i--)
+		{
+			if (memcmp(chunk.data() + i - 4, ARCHIVE_MAGIC, 4) != 0)
+				continue;
+			end = chunkStart + i;
+			if (end < FOOTER_SIZE)
+				return false;
+
+			uint32_t count;
+			char footer[FOOTER_SIZE];
+			if (!read(end - FOOTER_SIZE, FOOTER_SIZE, footer) || !ReadFooter(footer, end, indexOffset, count))
+				continue;
+			vector<char> indexData((size_t)(end - FOOTER_SIZE - indexOffset));
+			entries.clear();
+			if (!read(indexOffset, indexData.size(), indexData.data())
+				|| !ParseIndex(indexData.data(), indexData.size(), count, entries))
+				continue;
+			bool inside = true;
+			for (size_t k = 0; k < entries.size() && inside; k++)
+				inside = entries[k].offset + entries[k].size <= indexOffset;
+			if (inside)
+				return true;
+		}
+		if (chunkStart == 0)
+			break;
+		chunkEnd = chunkStart + 3;
+	}
+
+	return false;
+}
+
+bool ArchiveWriter::Open(const string& path)
+{
+	lock_guard<mutex> guard(lock);
+	entries.clear();
+	nameToEntry.clear();
+	dataEnd = 0;
+
+	ifstream infile(path, ios::binary | ios::in);
+	if (infile.is_open())
+	{
+		infile.seekg(0, ios::end);
+		uint64_t fileSize = infile.tellg();
+		if (fileSize > 0)
+		{
+			// 已有归档：读出最后一份完整的索引，新数据接在文件末尾（包括上次没写完的部分之后）
+			uint64_t end, indexOffset;
+			ReadAt read = [&infile](uint64_t offset, size_t len, char* out)
+			{
+				infile.clear();
+				infile.seekg(offset);
+				infile.read(out, len);
+				return !infile.fail();
+			};
+			if (!LocateIndex(fileSize, read, end, indexOffset, entries))
+				return false; // 不是归档，不覆盖
+
+			for (size_t i = 0; i < entries.size(); i++)
+				nameToEntry[entries[i].name] = i;
+			dataEnd = fileSize;
+		}
+		infile.close();
+	}
+
+	file.open(path, dataEnd > 0 ? (ios::binary | ios::in | ios::out) : (ios::binary | ios::out));
+	return file.is_open();
+}
+
+bool ArchiveWriter::Append(const string& name, const vector<char>& data)
+{
+	ArchiveEntry e;
+	e.name = name;
+	e.size = data.size();
+	if (!ImageCodec::ReadHeader(data.data(), data.size(), e.channel, e.rows, e.cols))
+		return false;
+
+	// 压缩在各线程里做完，这里只排队写
+	lock_guard<mutex> guard(lock);
+	if (!file.is_open())
+		return false;
+	e.offset = dataEnd;
+	file.seekp(dataEnd);
+	file.write(data.data(), data.size());
+	if (!file)
+		return false;
+	dataEnd += data.size();
+
+	unordered_map<string, size_t>::iterator it = nameToEntry.find(name);
+	if (it != nameToEntry.end())
+		entries[it->second] = e;
+	else
+	{
+		nameToEntry[name] = entries.size();
+		entries.push_back(e);
+	}
+
+	return true;
+}
+
+bool ArchiveWriter::Close()
+{
+	lock_guard<mutex> guard(lock);
+	if (!file.is_open())
+		return true;
+
+	vector<char> tail;
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const ArchiveEntry& e = entries[i];
+		uint32_t nameLen = e.name.size();
+		const char* p = reinterpret_cast<const char*>(&nameLen);
+		tail.insert(tail.end(), p, p + 4);
+		tail.insert(tail.end(), e.name.begin(), e.name.end());
+		p = reinterpret_cast<const char*>(&e.offset);
+		tail.insert(tail.end(), p, p + 8);
+		p = reinterpret_cast<const char*>(&e.size);
+		tail.insert(tail.end(), p, p + 4);
+		p = reinterpret_cast<const char*>(&e.channel);
+		tail.insert(tail.end(), p, p + 4);
+		p = reinterpret_cast<const char*>(&e.rows);
+		tail.insert(tail.end(), p, p + 4);
+		p = reinterpret_cast<const char*>(&e.cols);
+		tail.insert(tail.end(), p, p + 4);
+	}
+
+	uint32_t count = entries.size();
+	const char* p = reinterpret_cast<const char*>(&dataEnd);
+	tail.insert(tail.end(), p, p + 8);
+	p = reinterpret_cast<const char*>(&count);
+	tail.insert(tail.end(), p, p + 4);
+	tail.insert(tail.end(), ARCHIVE_MAGIC, ARCHIVE_MAGIC + 4);
+
+	file.seekp(dataEnd);
+	file.write(tail.data(), tail.size());
+	bool ok = !file.fail();
+	file.close();
+
+	return ok;
+}
+
+ArchiveReader::ArchiveReader()
+{
+	base = nullptr;
+	size = 0;
+	fileHandle = nullptr;
+	mapHandle = nullptr;
+}
+
+bool ArchiveReader::Open(const string& path)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	fileHandle = hFile;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart < (LONGLONG)FOOTER_SIZE)
+	{
+		Close();
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+	mapHandle = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapHandle == NULL)
+	{
+		Close();
+		return false;
+	}
+	base = static_cast<const char*>(MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0));
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	fileHandle = reinterpret_cast<void*>((intptr_t)fd + 1); // 0号fd也不为空
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)FOOTER_SIZE)
+	{
+		Close();
+		return false;
+	}
+	size = st.st_size;
+	void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	base = p == MAP_FAILED ? nullptr : static_cast<const char*>(p);
+#endif
+	if (base == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	// 只解析尾部和索引，数据部分按需访问
+	uint64_t end, indexOffset;
+	vector<ArchiveEntry> entries;
+	const char* data = base;
+	ReadAt read = [data](uint64_t offset, size_t len, char* out)
+	{
+		memcpy(out, data + offset, len);
+		return true;
+	};
+	if (!LocateIndex(size, read, end, indexOffset, entries))
+	{
+		Close();
+		return false;
+	}
+	for (size_t i = 0; i < entries.size(); i++)
+		if (entries[i].offset + entries[i].size <= indexOffset)
+			index[entries[i].name] = entries[i];
+
+	return true;
+}
+
+void ArchiveReader::Close()
+{
+#ifdef _WIN32
+	if (base != nullptr)
+		UnmapViewOfFile(base);
+	if (mapHandle != nullptr)
+		CloseHandle(mapHandle);
+	if (fileHandle != nullptr)
+		CloseHandle(fileHandle);
+#else
+	if (base != nullptr)
+		munmap(const_cast<char*>(base), size);
+	if (fileHandle != nullptr)
+		close((int)(reinterpret_cast<intptr_t>(fileHandle) - 1));
+#endif
+	base = nullptr;
+	size = 0;
+	fileHandle = nullptr;
+	mapHandle = nullptr;
+	index.clear();
+}
+
+const ArchiveEntry* ArchiveReader::Find(const string& name) const
+{
+	unordered_map<string, ArchiveEntry>::const_iterator it = index.find(name);
+	return it == index.end() ? nullptr : &it->second;
+}
+
+Mat ArchiveReader::Load(const string& name) const
+{
+	const ArchiveEntry* e = Find(name);
+	if (e == nullptr)
+		return Mat();
+
+	return ImageCodec::Decode(base + e->offset, e->size);
+}
+
+vector<string> ArchiveReader::Names() const
+{
+	vector<string> names;
+	for (auto i : index)
+		names.push_back(i.first);
+
+	return names;
+}
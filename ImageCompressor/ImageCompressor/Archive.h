@@ -0,0 +1,83 @@
+﻿/*
+	多图归档：把大量压缩后的图片打包进一个文件，尾部带索引，按名字直接定位解码
+
+	<文件格式>
+	数据1 | 数据2 | ... | 索引 | 索引偏移(8) | 条目数(4) | "ICAR"(4)
+	数据为 ImageCodec 的字节流，与单文件压缩的内容一致
+	索引条目：名字长度(4) | 名字 | 偏移(8) | 大小(4) | 通道数(4) | rows(4) | cols(4)
+
+	追加时新数据写在原文件末尾，最后重写一份索引和尾部，读取以最后一个完整的尾部为准：
+	追加中途退出时文件末尾是没写完的数据，读写时都会往前找到上一次的尾部，原来的内容仍然可读
+	旧的索引、没写完的数据和被同名覆盖的数据都留在文件里，不会回收（没有压缩整理），
+	反复追加的归档会比其中的数据大
+*/
+#pragma once
+#include "opencv2/opencv.hpp"
+#include "opencv2/core/core.hpp"
+#include "iostream"
+#include "fstream"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+using namespace cv;
+using namespace std;
+
+struct ArchiveEntry
+{
+	string name;
+	uint64_t offset; // 数据在文件中的偏移
+	uint32_t size;   // 数据字节数
+	int channel;
+	int rows;
+	int cols;
+};
+
+// 写归档，Append 可以被多个压缩线程同时调用
+class ArchiveWriter
+{
+public:
+	ArchiveWriter() : dataEnd(0) {}
+
+	~ArchiveWriter() { Close(); }
+
+	bool Open(const string& path); // 文件已是归档则追加，否则新建
+
+	bool Append(const string& name, const vector<char>& data); // 同名覆盖旧条目
+
+	bool Close(); // 写索引和尾部
+
+private:
+	mutex lock;
+	fstream file;
+	uint64_t dataEnd; // 下一段数据写入的位置
+	vector<ArchiveEntry> entries;
+	unordered_map<string, size_t> nameToEntry;
+};
+
+// 读归档，整个文件映射到内存，只解析尾部和索引，按名字取数据不需要扫描
+class ArchiveReader
+{
+public:
+	ArchiveReader();
+
+	~ArchiveReader() { Close(); }
+
+	bool Open(const string& path);
+
+	void Close();
+
+	const ArchiveEntry* Find(const string& name) const;
+
+	Mat Load(const string& name) const; // 按名字解码，找不到或数据损坏返回空Mat
+
+	vector<string> Names() const;
+
+private:
+	const char* base; // 映射的文件内容
+	size_t size;
+	void* fileHandle;
+	void* mapHandle;
+	unordered_map<string, ArchiveEntry> index;
+};
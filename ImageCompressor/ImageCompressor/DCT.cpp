@@ -6,24 +6,184 @@
 #include "math.h"
 
 #include "DCT.h"
+#include "Order.h"
 
-Mat DCT::DCT8x8(Mat image) // DCT任صͼpadding,int
+// NxN ucharСֵֵ͡ƽ
+template<int N>
+static void BlockStats(const uchar* p, size_t step, int& minVal, int& maxVal, int& sum, int& sqSum)
 {
-	// 8
-	int width = image.cols % 8== 0 ? image.cols: image.cols + 8 - image.cols % 8; // ȫͼ
-	int height = image.rows % 8 == 0 ? image.rows: image.rows + 8 - image.rows % 8; // ȫͼ߶
+	minVal = 255, maxVal = 0, sum = 0, sqSum = 0;
+	for (int r = 0; r < N; r++)
+	{
+		for (int c = 0; c < N; c++)
+		{
+			int v = p[r * step + c];
+			minVal = v < minVal ? v : minVal;
+			maxVal = v > maxVal ? v : maxVal;
+			sum += v;
+			sqSum += v * v;
+		}
+	}
+}
+
+#if DCT_SIMD
+// 8x8 һ8ֽڣSSE2
+template<>
+void BlockStats<8>(const uchar* p, size_t step, int& minVal, int& maxVal, int& sum, int& sqSum)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i vmin = _mm_set1_epi8(-1), vmax = zero, vsum = zero, vsq = zero;
+	for (int r = 0; r < 8; r++)
+	{
+		__m128i row = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + r * step)); // 8ֽ
+		vmin = _mm_min_epu8(vmin, row);
+		vmax = _mm_max_epu8(vmax, row);
+		vsum = _mm_add_epi64(vsum, _mm_sad_epu8(row, zero));
+		__m128i w = _mm_unpacklo_epi8(row, zero);
+		vsq = _mm_add_epi32(vsq, _mm_madd_epi16(w, w));
+	}
+	// ֻ͵ֽ/Ԫأλʲôν
+	vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 4));
+	vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 2));
+	vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 1));
+	vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 4));
+	vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 2));
+	vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 1));
+	vsq = _mm_add_epi32(vsq, _mm_srli_si128(vsq, 8));
+	vsq = _mm_add_epi32(vsq, _mm_srli_si128(vsq, 4));
+	minVal = _mm_cvtsi128_si32(vmin) & 0xFF;
+	maxVal = _mm_cvtsi128_si32(vmax) & 0xFF;
+	sum = _mm_cvtsi128_si32(vsum);
+	sqSum = _mm_cvtsi128_si32(vsq);
+}
+#endif
+
+// NxN intDCǷȫΪ0
+template<int N>
+static bool OnlyDC(const int* p, size_t step)
+{
+	for (int r = 0; r < N; r++)
+	{
+		const int* row = reinterpret_cast<const int*>(reinterpret_cast<const uchar*>(p) + r * step);
+		for (int c = (r == 0 ? 1 : 0); c < N; c++)
+			if (row[c] != 0)
+				return false;
+	}
+	return true;
+}
+
+#if DCT_SIMD
+template<>
+bool OnlyDC<8>(const int* p, size_t step)
+{
+	__m128i acc = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), _mm_setr_epi32(0, -1, -1, -1));
+	acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 4)));
+	for (int r = 1; r < 8; r++)
+	{
+		const int* row = reinterpret_cast<const int*>(reinterpret_cast<const uchar*>(p) + r * step);
+		acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row)));
+		acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 4)));
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi32(acc, _mm_setzero_si128())) == 0xFFFF;
+}
+#endif
+
+// 任 out = C * X * C^Tϵ
+template<int N>
+static inline void ForwardBlock(const DCTTable<N>& t, const double* in, double* out, size_t outStep)
+{
+	double tmp[N * N];
+	for (int i = 0; 2 * i <= N; i++) // N/2ȫ
+	{
+		for (int j = 0; j < N; j++)
+		{
+			double s = 0;
+			for (int k = 0; k < N; k++)
+				s += t.m[i][k] * in[k * N + j];
+			tmp[i * N + j] = s;
+		}
+	}
+
+	for (int i = 0; 2 * i <= N; i++)
+	{
+		double* o = reinterpret_cast<double*>(reinterpret_cast<uchar*>(out) + i * outStep);
+		for (int j = 0; j < N; j++)
+		{
+			if (!t.mask[i][j])
+				continue;
+			double s = 0;
+			for (int k = 0; k < N; k++)
+				s += tmp[i * N + k] * t.m[j][k];
+			o[j] = s;
+		}
+	}
+}
+
+// 任 out = C^T * Y * C
+template<int N>
+static inline void InverseBlock(const DCTTable<N>& t, const double* in, double* out, size_t outStep)
+{
+	double tmp[N * N];
+	for (int i = 0; i < N; i++)
+	{
+		for (int j = 0; j < N; j++)
+		{
+			double s = 0;
+			for (int k = 0; k < N; k++)
+				s += t.m[k][i] * in[k * N + j];
+			tmp[i * N + j] = s;
+		}
+	}
+
+	for (int i = 0; i < N; i++)
+	{
+		double* o = reinterpret_cast<double*>(reinterpret_cast<uchar*>(out) + i * outStep);
+		for (int j = 0; j < N; j++)
+		{
+			double s = 0;
+			for (int k = 0; k < N; k++)
+				s += tmp[i * N + k] * t.m[k][j];
+			o[j] = s;
+		}
+	}
+}
+
+template<int N>
+Mat BlockDCT<N>::DCTNxN(Mat image) // DCT任صͼpadding,int
+{
+	// N
+	int width = Padded(image.cols); // ȫͼ
+	int height = Padded(image.rows); // ȫͼ߶
 	Mat output = Mat::zeros(height, width, CV_64FC1); // 任ͼ
-	Mat paddedImage; // 8x8ԭͼ
+	Mat paddedImage; // NxNԭͼ
 	copyMakeBorder(image, paddedImage, 0, height - image.rows, 0, width - image.cols, BORDER_CONSTANT, Scalar(0));
+	Mat pixels = paddedImage; // ucharԭͼжƽ̹
+	bool classify = pixels.type() == CV_8UC1 && flatThreshold > 0;
 	paddedImage.convertTo(paddedImage, CV_64FC1);
-	for (int y = 0; y < height; y += 8) 
+	skippedBlocks = 0;
+	double block[N * N];
+	for (int y = 0; y < height; y += N) 
 	{
-		for (int x = 0; x < width; x += 8) 
+		for (int x = 0; x < width; x += N) 
 		{
-			Mat block = paddedImage(Rect(x, y, 8, 8));
-			Mat dctBlock = DCTMat * block * iDCTMat; // dct
-			dctBlock = mask.mul(dctBlock); // 
-			dctBlock.copyTo(output(Rect(x, y, 8, 8)));
+			// ƽ̹飨0ACΪ0ֱӸDC = ֵ*N
+			if (classify)
+			{
+				int minVal, maxVal, sum, sqSum;
+				BlockStats<N>(pixels.ptr<uchar>(y) + x, pixels.step, minVal, maxVal, sum, sqSum);
+				double mean = sum / (double)(N * N);
+				double variance = sqSum / (double)(N * N) - mean * mean;
+				if (minVal == maxVal || variance < flatThreshold)
+				{
+					output.at<double>(y, x) = sum / (double)N;
+					skippedBlocks++;
+					continue;
+				}
+			}
+
+			for (int r = 0; r < N; r++)
+				memcpy(block + r * N, paddedImage.ptr<double>(y + r) + x, N * sizeof(double));
+			ForwardBlock<N>(table, block, output.ptr<double>(y) + x, output.step); // dct + 
 		}
 	}
 
@@ -34,22 +194,36 @@ Mat DCT::DCT8x8(Mat image) // DCT
 	return output;
 }
 
-Mat DCT::iDCT8x8(Mat image)	// DCT任صͼpaddingģuchar
+template<int N>
+Mat BlockDCT<N>::iDCTNxN(Mat image)	// DCT任صͼpaddingģuchar
 {
-	// 8
-	int width = image.cols % 8 == 0 ? image.cols : image.cols + 8 - image.cols % 8; // ȫͼ
-	int height = image.rows % 8 == 0 ? image.rows : image.rows + 8 - image.rows % 8; // ȫͼ߶
+	// N
+	int width = Padded(image.cols); // ȫͼ
+	int height = Padded(image.rows); // ȫͼ߶
 	Mat output = Mat::zeros(height, width, CV_64FC1); // 任ͼ
-	Mat paddedImage; // 8x8ԭͼ
+	Mat paddedImage; // NxNԭͼ
 	copyMakeBorder(image, paddedImage, 0, height - image.rows, 0, width - image.cols, BORDER_CONSTANT, Scalar(0));
+	Mat coeffs = paddedImage; // intϵжֻDCĿ
+	bool classify = coeffs.type() == CV_32SC1;
 	paddedImage.convertTo(paddedImage, CV_64FC1);
-	for (int y = 0; y < height; y += 8)
+	skippedBlocks = 0;
+	double block[N * N];
+	for (int y = 0; y < height; y += N)
 	{
-		for (int x = 0; x < width; x += 8)
+		for (int x = 0; x < width; x += N)
 		{
-			Mat block = paddedImage(Rect(x, y, 8, 8));
-			Mat dctBlock = iDCTMat * block * DCTMat; // idct
-			dctBlock.copyTo(output(Rect(x, y, 8, 8)));
+			// ֻDCͬһֵ˷Ľͬ
+			if (classify && OnlyDC<N>(coeffs.ptr<int>(y) + x, coeffs.step))
+			{
+				double value = table.m[0][0] * coeffs.at<int>(y, x) * table.m[0][0];
+				output(Rect(x, y, N, N)) = Scalar(value);
+				skippedBlocks++;
+				continue;
+			}
+
+			for (int r = 0; r < N; r++)
+				memcpy(block + r * N, paddedImage.ptr<double>(y + r) + x, N * sizeof(double));
+			InverseBlock<N>(table, block, output.ptr<double>(y) + x, output.step); // idct
 		}
 	}
 
@@ -59,4 +233,61 @@ Mat DCT::iDCT8x8(Mat image)	// DCT
 	return output;
 }
 
+template<int N>
+void BlockDCT<N>::DCTBlock(const uchar* src, size_t step, int* coeffs)
+{
+	static constexpr ZigzagTable<N> zigzag = ZigzagTable<N>();
+	memset(coeffs, 0, N * N * sizeof(int));
+
+	int minVal, maxVal, sum, sqSum;
+	BlockStats<N>(src, step, minVal, maxVal, sum, sqSum);
+	double mean = sum / (double)(N * N);
+	double variance = sqSum / (double)(N * N) - mean * mean;
+	if (flatThreshold > 0 && (minVal == maxVal || variance < flatThreshold))
+	{
+		coeffs[0] = cvRound(sum / (double)N);
+		skippedBlocks++;
+		return;
+	}
+
+	double block[N * N], output[N * N] = {};
+	for (int r = 0; r < N; r++)
+		for (int c = 0; c < N; c++)
+			block[r * N + c] = src[r * step + c];
+	ForwardBlock<N>(table, block, output, N * sizeof(double));
+	for (int k = 0; k < N * N; k++)
+		coeffs[zigzag.pos[k]] = cvRound(output[k]);
+}
+
+template<int N>
+void BlockDCT<N>::iDCTBlock(const int* coeffs, uchar* dst, size_t step)
+{
+	static constexpr ZigzagTable<N> zigzag = ZigzagTable<N>();
+	int natural[N * N];
+	for (int k = 0; k < N * N; k++)
+		natural[k] = coeffs[zigzag.pos[k]];
+
+	if (OnlyDC<N>(natural, N * sizeof(int)))
+	{
+		uchar value = saturate_cast<uchar>(table.m[0][0] * natural[0] * table.m[0][0]);
+		for (int r = 0; r < N; r++)
+			memset(dst + r * step, value, N);
+		skippedBlocks++;
+		return;
+	}
+
+	double block[N * N], output[N * N];
+	for (int k = 0; k < N * N; k++)
+		block[k] = natural[k];
+	InverseBlock<N>(table, block, output, N * sizeof(double));
+	for (int r = 0; r < N; r++)
+		for (int c = 0; c < N; c++)
+			dst[r * step + c] = saturate_cast<uchar>(output[r * N + c]);
+}
+
+template<int N>
+const DCTTable<N> BlockDCT<N>::table;
 
+template class BlockDCT<4>;
+template class BlockDCT<8>;
+template class BlockDCT<16>;
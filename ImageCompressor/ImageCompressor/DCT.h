@@ -1,11 +1,14 @@
 /*
 	룺Mat
 
-	1Matֳ8x8飬㲹
-	2ÿһ飬dctõ8x8ϵ
+	1MatֳNxN飬㲹
+	2ÿһ飬dctõNxNϵ
 	3пƴ
 
 	DCT/iDCTϵMat
+
+	С N Ϊģ4/8/16ÿֿСdctֻһΣ
+	ڵľ˷ѭǳȫչ
 */
 #pragma once
 #include "opencv2/opencv.hpp"
@@ -21,60 +24,65 @@
 #include "math.h"
 #include "stdio.h"
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define DCT_SIMD 1
+#include <emmintrin.h>
+#else
+#define DCT_SIMD 0
+#endif
+
 using namespace cv;
 using namespace std;
 
-class DCT {
-public:
-
-	DCT()
-	{
-		DCTMat = Mat::zeros(8, 8, CV_64FC1);
-		iDCTMat = Mat::zeros(8, 8, CV_64FC1);
-		mask = Mat::zeros(8, 8, CV_64FC1);
-
-		SetDCTMat();
-		SetiDCTMat();
-		SetMask();
-	}
+template<int N>
+struct DCTTable
+{
+	double m[N][N]; // dct任ת
+	bool mask[N][N]; // ֻϽǵĵƵϵi + j <= 5N/8  i, j <= N/2
 
-	void SetDCTMat() // dct
+	// dctʱ sqrt/cosԭ8x8Ĺʽȫһalpha floatȣ
+	// Լcosĩλв .5 ϵϵͻ뵽һ
+	DCTTable()
 	{
-		for (int i = 0; i < 8; i++)
-			for (int j = 0; j < 8; j++) 
+		for (int i = 0; i < N; i++)
+		{
+			for (int j = 0; j < N; j++)
 			{
-				double alpha = (i == 0) ? sqrt(1.0f / 8) : sqrt(2.0f / 8);
-				DCTMat.at<double>(i, j) = alpha * cos((j + 0.5f) * CV_PI * i / 8);
+				double alpha = (i == 0) ? sqrt(1.0f / N) : sqrt(2.0f / N);
+				m[i][j] = alpha * cos((j + 0.5f) * CV_PI * i / N);
+				mask[i][j] = 8 * (i + j) <= 5 * N && 2 * i <= N && 2 * j <= N;
 			}
-
+		}
 	}
+};
 
-	void SetiDCTMat() // dct
-	{
-		for (int j = 0; j < 8; ++j)
-			for (int i = 0; i < 8; ++i)
-				iDCTMat.at<double>(i, j) = DCTMat.at<double>(j, i);
-	}
+template<int N>
+class BlockDCT {
+public:
+	static_assert(N == 4 || N == 8 || N == 16, "block size must be 4, 8 or 16");
 
-	void SetMask() // 
-	{
-		mask = (Mat_<double>(8, 8)
-		 << 1, 1, 1, 1, 1, 0, 0, 0,
-			1, 1, 1, 1, 1, 0, 0, 0,
-			1, 1, 1, 1, 0, 0, 0, 0,
-			1, 1, 1, 0, 0, 0, 0, 0,
-			1, 1, 0, 0, 0, 0, 0, 0,
-			0, 0, 0, 0, 0, 0, 0, 0,
-			0, 0, 0, 0, 0, 0, 0, 0,
-			0, 0, 0, 0, 0, 0, 0, 0);
-	}
+	BlockDCT(double flatThreshold = 1.0) : flatThreshold(flatThreshold), skippedBlocks(0) {}
+
+	static int Padded(int n) { return n % N == 0 ? n : n + N - n % N; } // 뵽N
+
+	Mat DCTNxN(Mat image); // DCT任
 
-	Mat DCT8x8(Mat image); // DCT任
+	Mat iDCTNxN(Mat image); // 任
 
-	Mat iDCT8x8(Mat image); // 任
+	// 任Matһ DCTNxN + ZigZag ͬ
+	// src ΪNxNuchar飨оstepֽڣcoeffs N*Nzigzag˳ϵ
+	void DCTBlock(const uchar* src, size_t step, int* coeffs);
+
+	// 任 iZigZag + iDCTNxN ͬcoeffs Ϊzigzag˳dst ΪNxNuchar
+	void iDCTBlock(const int* coeffs, uchar* dst, size_t step);
+
+	int SkippedBlocks() const { return skippedBlocks; } // һ任аƽֱ̹ӴĿ任ۼ
 
 private:
-	Mat DCTMat;
-	Mat iDCTMat;
-	Mat mask; // 8x8 ʵֱӰϵȥˣ
-};
\ No newline at end of file
+	static const DCTTable<N> table;
+
+	double flatThreshold; // ڷʱֻDC任
+	int skippedBlocks;
+};
+
+typedef BlockDCT<8> DCT;
@@ -3,6 +3,10 @@
 #include <vector>
 #include <queue>
 #include <unordered_map>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <math.h>
 #include "HuffmanCode.h"
 
 using namespace std;
@@ -64,7 +68,7 @@ void HuffmanCode::SetCodeTable()
 		SearchCode(treeRoot, empty);
 }
 
-vector<char> HuffmanCode::CharToBit(vector<char>& charSeq) // յֽ
+vector<char> HuffmanCode::CharToBit(const CountedVector<char>& charSeq) // յֽ
 {
 	// charλλ
 	// charΪ 0 0 0 0 1 0 1 1
@@ -138,7 +142,7 @@ vector<char> HuffmanCode::Encode(const vector<int>& data)
 {
 	// ԭ֮⣬valToWeightֽлͷ
 	// headLength | head(hashmap) | bitLength | bitSequence
-	vector<char> rawCode; //  char
+	CountedVector<char> rawCode; //  charÿbitһֽ
 	vector<char> result; // صbitstream
 	uint32_t headLen = 0; // лõͷ
 
@@ -149,8 +153,8 @@ vector<char> HuffmanCode::Encode(const vector<int>& data)
 	// ֻһvalļ: map 12 | bitsize 4 | bitseq
 	if (valToWeight.size() == 1)
 	{
-		vector<char> res(data.size(), 0);
-		res = CharToBit(res);
+		CountedVector<char> zeros(data.size(), '0');
+		vector<char> res = CharToBit(zeros);
 		int p = data.size();
 		char* ptr = reinterpret_cast<char*>(&p);
 		vector<char> bs(4);
@@ -188,9 +192,9 @@ vector<char> HuffmanCode::Encode(const vector<int>& data)
 	return result;
 }
 
-vector<char> HuffmanCode::BitToChar(const vector<char>& bitSeq, uint32_t bitCount)
+CountedVector<char> HuffmanCode::BitToChar(const vector<char>& bitSeq, uint32_t bitCount)
 {
-	vector<char> charSeq(bitCount);
+	CountedVector<char> charSeq(bitCount);
 	int cnt = 0; // char vector±
 	int bitIdx = 0; // bit vector±
 	int bit = 0; // ǰcharλ
@@ -218,6 +222,8 @@ vector<int> HuffmanCode::Decode(const vector<char>& bitSeq) // 
 	for (int i = 0; i < 4; i++)
 		p[i] = bitSeq[i];
 	uint32_t *headLen = reinterpret_cast<uint32_t*>(p); // map size
+	if (*headLen & STATIC_FLAG) // ̬ͷֻбID
+		return DecodeStatic(bitSeq, *headLen & ~STATIC_FLAG);
 	//cout << "map size: " << *headLen << endl;
 
 	// ʼ
@@ -241,7 +247,7 @@ vector<int> HuffmanCode::Decode(const vector<char>& bitSeq) // 
 	if (valToWeight.size() == 1)
 	{
 		vector<char> r(bitSeq.begin() + 16, bitSeq.end());
-		vector<char> cs = BitToChar(r, bitSize);
+		CountedVector<char> cs = BitToChar(r, bitSize);
 		unordered_map<int, uint32_t>::iterator it = valToWeight.begin();
 		vector<int> res(cs.size(), it->first);
 		return res;
@@ -251,7 +257,7 @@ vector<int> HuffmanCode::Decode(const vector<char>& bitSeq) // 
 	SetCodeTable();
 
 	vector<char> dataSeq(bitSeq.begin()+dataStart+4, bitSeq.end());
-	vector<char> charSeq = BitToChar(dataSeq, bitSize); // תchar
+	CountedVector<char> charSeq = BitToChar(dataSeq, bitSize); // תchar
 
 	vector<int> result;
 	HuffmanNode* ptr = treeRoot;
@@ -272,4 +278,351 @@ vector<int> HuffmanCode::Decode(const vector<char>& bitSeq) // 
 	}
 
 	return result;
-}
\ No newline at end of file
+}
+
+void HuffmanCode::DecodeRange(const unsigned char* bits, uint32_t bitSize, uint32_t start, uint32_t stop,
+	vector<int>& vals, vector<uint32_t>& ends) const
+{
+	HuffmanNode* ptr = treeRoot;
+	for (uint32_t i = start; i < bitSize; i++)
+	{
+		ptr = (bits[i >> 3] >> (7 - (i & 7))) & 1 ? ptr->right : ptr->left;
+		if (ptr->left == nullptr && ptr->right == nullptr) // õһval
+		{
+			vals.push_back(ptr->val);
+			ends.push_back(i + 1);
+			ptr = treeRoot;
+			if (i + 1 >= stop)
+				return;
+		}
+	}
+}
+
+vector<int> HuffmanCode::DecodeParallel(const vector<char>& bitSeq, int threadNum)
+{
+	// ÿôbit̵̫в
+	const uint32_t MIN_CHUNK_BITS = 1 << 16;
+
+	uint32_t headLen, bitSize;
+	memcpy(&headLen, bitSeq.data(), 4);
+	if ((headLen & STATIC_FLAG) || headLen <= 1)
+		return Decode(bitSeq);
+	uint32_t dataStart = headLen * 8 + 4;
+	memcpy(&bitSize, bitSeq.data() + dataStart, 4);
+
+	if (threadNum <= 0)
+		threadNum = thread::hardware_concurrency();
+	int chunkNum = (int)(bitSize / MIN_CHUNK_BITS);
+	chunkNum = chunkNum < threadNum ? chunkNum : threadNum;
+	if (chunkNum < 2)
+		return Decode(bitSeq);
+
+	// ʼ
+	treeRoot = nullptr;
+	remainNode = priority_queue <HuffmanNode*, vector<HuffmanNode*>, cmp>();
+	valToWeight.clear();
+	valToCode.clear();
+	DeserializeMap(bitSeq, headLen);
+	BuildTree();
+	SetCodeTable();
+
+	const unsigned char* bits = reinterpret_cast<const unsigned char*>(bitSeq.data()) + dataStart + 4;
+
+	// ֳchunkNumΣÿδӲµ㣨ףʼ룬һֱ⵽Խβĵһֱ߽
+	// ײһֱ߽磬Huffmanͬ⼸ֺ߽ͨʵغ
+	vector<uint32_t> starts(chunkNum + 1);
+	for (int i = 0; i <= chunkNum; i++)
+		starts[i] = (uint32_t)((uint64_t)bitSize * i / chunkNum);
+
+	vector<vector<int> > vals(chunkNum);
+	vector<vector<uint32_t> > ends(chunkNum);
+	vector<thread> workers;
+	for (int i = 0; i < chunkNum; i++)
+		workers.push_back(thread([&, i]() { DecodeRange(bits, bitSize, starts[i], starts[i + 1], vals[i], ends[i]); }));
+	for (int i = 0; i < chunkNum; i++)
+		workers[i].join();
+
+	// 0Ǵʵģֱã֮ÿҵһʵλغϵı߽磬ƴ
+	vector<int> result;
+	size_t total = 0;
+	for (int i = 0; i < chunkNum; i++)
+		total += vals[i].size();
+	result.reserve(total);
+	result.insert(result.end(), vals[0].begin(), vals[0].end());
+	uint32_t cur = ends[0].empty() ? starts[0] : ends[0].back(); // ʵ뵽λãֱ߽
+
+	for (int i = 1; i < chunkNum; i++)
+	{
+		if (cur >= starts[i + 1] && i + 1 < chunkNum)
+			continue; // һεһѾһ
+
+		size_t from = 0;
+		bool synced = cur == starts[i];
+		if (!synced)
+		{
+			vector<uint32_t>::iterator it = lower_bound(ends[i].begin(), ends[i].end(), cur);
+			synced = it != ends[i].end() && *it == cur;
+			from = it - ends[i].begin() + 1;
+		}
+
+		if (synced)
+		{
+			result.insert(result.end(), vals[i].begin() + from, vals[i].end());
+			if (from < ends[i].size())
+				cur = ends[i].back();
+		}
+		else
+		{
+			// ζûͬϣʵλ½һ
+			Stats::Add("huffman chunks re-decoded");
+			vector<int> v;
+			vector<uint32_t> e;
+			DecodeRange(bits, bitSize, cur, starts[i + 1], v, e);
+			result.insert(result.end(), v.begin(), v.end());
+			if (!e.empty())
+				cur = e.back();
+		}
+	}
+
+	return result;
+}
+
+const uint32_t HuffmanCode::STATIC_FLAG;
+const uint32_t HuffmanCode::DEFAULT_TABLE;
+const uint32_t HuffmanCode::MAX_TABLE;
+const int HuffmanCode::ESCAPE;
+
+void HuffmanCode::SetBitTable()
+{
+	for (auto i : valToCode)
+	{
+		uint64_t bits = 0;
+		for (int j = 0; j < i.second.size(); j++)
+			bits = (bits << 1) | (i.second[j] - '0');
+		valToBits[i.first] = make_pair(bits, (int)i.second.size());
+	}
+}
+
+unordered_map<int, uint32_t> HuffmanCode::DefaultWeights()
+{
+	// ñȨذ pictures/ RLEϣС4/8/16
+	// 1ACϵͶγ̼0Ȩ|v|½
+	// 2ûеƽƫƣDCΪ N*ֵ8x80..2040֮䣬Ƚƽ16x16ɵ4080
+	// 3ÿһϵ֮γ N*N/2..N*N-1ֻDCĿΪ N*N-1
+	unordered_map<int, uint32_t> weights;
+	for (int v = -1024; v <= 1024; v++)
+		weights[v] = 1 + (uint32_t)(4e6 / pow(1.0 + abs(v), 1.5));
+	for (int v = 0; v < 64; v++)
+		weights[v] += (uint32_t)(6e5 / ((1.0 + v) * (1.0 + v)));
+	for (int v = 0; v <= 2048; v++)
+		weights[v] += 250;
+	for (int v = 2049; v <= 16 * 255; v++)
+		weights[v] = 20;
+	for (int n = 4; n <= 16; n *= 2)
+	{
+		for (int v = n * n / 2; v < n * n; v++)
+			weights[v] += 2500;
+		weights[n * n - 1] += 40000;
+	}
+	weights[ESCAPE] = 16;
+
+	return weights;
+}
+
+unordered_map<uint32_t, shared_ptr<HuffmanCode> >& HuffmanCode::Tables()
+{
+	static unordered_map<uint32_t, shared_ptr<HuffmanCode> > tables = { { DEFAULT_TABLE, MakeTable(DefaultWeights()) } };
+	return tables;
+}
+
+shared_ptr<HuffmanCode> HuffmanCode::MakeTable(unordered_map<int, uint32_t> weights)
+{
+	// ֤ESCAPEҶ
+	if (weights.find(ESCAPE) == weights.end())
+		weights[ESCAPE] = 1;
+	if (weights.size() == 1)
+		weights[0] = 1;
+
+	// ܴʱСȨأֹʱuint32
+	uint64_t total = 0;
+	for (auto i : weights)
+		total += i.second;
+	uint64_t factor = total / 0x7fffffff + 1;
+	for (auto& i : weights)
+		i.second = (uint32_t)(i.second / factor) + 1;
+
+	shared_ptr<HuffmanCode> table = make_shared<HuffmanCode>();
+	table->valToWeight = weights;
+	table->BuildTree();
+	table->SetCodeTable();
+	table->SetBitTable();
+
+	return table;
+}
+
+bool HuffmanCode::RegisterTable(uint32_t id, unordered_map<int, uint32_t> weights)
+{
+	if (!ValidTableId(id))
+		return false;
+	Tables()[id] = MakeTable(weights);
+	return true;
+}
+
+bool HuffmanCode::HasTable(uint32_t id)
+{
+	return Tables().count(id) > 0;
+}
+
+// ļ: id | size | (val, weight) * size
+bool HuffmanCode::SaveTable(const string& path, uint32_t id, const unordered_map<int, uint32_t>& weights)
+{
+	if (!ValidTableId(id))
+		return false;
+	ofstream outfile(path, ios::binary | ios::out);
+	if (!outfile.is_open())
+		return false;
+
+	vector<uint32_t> data;
+	data.push_back(id);
+	data.push_back(weights.size());
+	for (auto i : weights)
+	{
+		data.push_back(i.first);
+		data.push_back(i.second);
+	}
+	outfile.write(reinterpret_cast<char*>(data.data()), data.size() * 4);
+	outfile.close();
+
+	return true;
+}
+
+bool HuffmanCode::LoadTable(const string& path, uint32_t& id)
+{
+	ifstream infile(path, ios::binary | ios::in);
+	if (!infile.is_open())
+		return false;
+
+	uint32_t size = 0;
+	infile.read(reinterpret_cast<char*>(&id), 4);
+	infile.read(reinterpret_cast<char*>(&size), 4);
+	if (!infile || !ValidTableId(id))
+		return false;
+	vector<uint32_t> data(size * 2);
+	infile.read(reinterpret_cast<char*>(data.data()), data.size() * 4);
+	if (!infile)
+		return false;
+
+	unordered_map<int, uint32_t> weights;
+	for (uint32_t i = 0; i < size; i++)
+		weights[(int)data[i * 2]] = data[i * 2 + 1];
+	return RegisterTable(id, weights);
+}
+
+vector<char> HuffmanCode::Encode(const vector<int>& data, uint32_t tableId)
+{
+	return Encode(data, *Tables().at(tableId), tableId);
+}
+
+vector<char> HuffmanCode::Encode(const vector<int>& data, const HuffmanCode& table, uint32_t tableId)
+{
+	// ֳɵģͳƵʡҲдƵʱһֱõbit
+	// STATIC_FLAG|tableId | bitLength | bitSequence
+	const pair<uint64_t, int>& escape = table.valToBits.at(ESCAPE);
+
+	vector<char> result(8);
+	result.reserve(8 + data.size());
+	uint32_t bitSize = 0;
+	uint64_t acc = 0; // δдbitλǰ
+	int accBits = 0;
+
+	auto put = [&](uint64_t code, int len)
+	{
+		acc = (acc << len) | code;
+		accBits += len;
+		bitSize += len;
+		while (accBits >= 8)
+		{
+			accBits -= 8;
+			result.push_back((char)(acc >> accBits));
+		}
+	};
+
+	for (int i = 0; i < data.size(); i++)
+	{
+		auto it = table.valToBits.find(data[i]);
+		if (it != table.valToBits.end() && data[i] != ESCAPE)
+			put(it->second.first, it->second.second);
+		else
+		{
+			put(escape.first, escape.second);
+			put((uint32_t)data[i], 32);
+		}
+	}
+	if (accBits > 0)
+		result.push_back((char)(acc << (8 - accBits)));
+
+	uint32_t head = STATIC_FLAG | tableId;
+	memcpy(result.data(), &head, 4);
+	memcpy(result.data() + 4, &bitSize, 4);
+
+	return result;
+}
+
+vector<int> HuffmanCode::DecodeStatic(const vector<char>& bitSeq, uint32_t tableId)
+{
+	if (!HasTable(tableId))
+	{
+		cout << "Unknown Huffman table: " << tableId << endl;
+		return vector<int>();
+	}
+
+	return DecodeStatic(bitSeq, *Tables().at(tableId));
+}
+
+vector<int> HuffmanCode::DecodeStatic(const vector<char>& bitSeq, const HuffmanCode& table)
+{
+	vector<int> result;
+	uint32_t bitSize;
+	memcpy(&bitSize, bitSeq.data() + 4, 4);
+	const unsigned char* bits = reinterpret_cast<const unsigned char*>(bitSeq.data()) + 8;
+
+	// ֱӰλչchar
+	uint32_t i = 0;
+	while (i < bitSize)
+	{
+		HuffmanNode* ptr = table.treeRoot;
+		while (ptr->left != nullptr && i < bitSize)
+		{
+			ptr = (bits[i >> 3] >> (7 - (i & 7))) & 1 ? ptr->right : ptr->left;
+			i++;
+		}
+
+		int val = ptr->val;
+		if (val == ESCAPE)
+		{
+			uint32_t raw = 0;
+			for (int k = 0; k < 32; k++, i++)
+				raw = (raw << 1) | ((bits[i >> 3] >> (7 - (i & 7))) & 1);
+			val = (int)raw;
+		}
+		result.push_back(val);
+	}
+
+	return result;
+}
+
+uint64_t HuffmanCode::CodeLength(const unordered_map<int, uint32_t>& histogram) const
+{
+	const pair<uint64_t, int>& escape = valToBits.at(ESCAPE);
+	uint64_t bits = 0;
+	for (auto i : histogram)
+	{
+		auto it = valToBits.find(i.first);
+		if (it != valToBits.end() && i.first != ESCAPE)
+			bits += (uint64_t)i.second * it->second.second;
+		else
+			bits += (uint64_t)i.second * (escape.second + 32);
+	}
+
+	return bits;
+}
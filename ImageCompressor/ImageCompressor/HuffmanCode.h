@@ -14,6 +14,12 @@
 #include <vector>
 #include <queue>
 #include <unordered_map>
+#include <memory>
+#include <string>
+#include <climits>
+#include <thread>
+
+#include "Stats.h"
 
 using namespace std;
 // Ϊɶôvector
@@ -40,19 +46,66 @@ public:
 
 	void SearchCode(HuffmanNode* root, vector<char> code); // dfs
 
-	vector<char> CharToBit(vector<char>& ); // յbit
+	vector<char> CharToBit(const CountedVector<char>& ); // յbit
 
-	vector<char> BitToChar(const vector<char>& , uint32_t );
+	CountedVector<char> BitToChar(const vector<char>& , uint32_t );
 
 	vector<char> Encode(const vector<int>& data); // 
 
+	vector<char> Encode(const vector<int>& data, uint32_t tableId); // þ̬룬
+
 	vector<int> Decode(const vector<char>& bitSeq); // 
 
+	// ߳̽뵥ľɸʽļDecodeȫͬʽֱDecode
+	vector<int> DecodeParallel(const vector<char>& bitSeq, int threadNum = 0);
+
 	vector<char> SerializeMap();
 
 	void DeserializeMap(vector<char> bitSeq, int size);
 
+	const unordered_map<int, uint32_t>& GetWeightTable() const { return valToWeight; }
+
+	// ̬Ĭϱ(ID 0)ѵıͷֻдID
+	// STATIC_FLAG|tableId | bitLength | bitSequence
+	static const uint32_t STATIC_FLAG = 0x80000000;
+	static const uint32_t DEFAULT_TABLE = 0;
+	static const uint32_t MAX_TABLE = 65535; // ѵ/ıIDΪ 1~MAX_TABLE0ñ
+	static const int ESCAPE = INT_MIN; // ֵESCAPEı + 32λԭֵ
+
+	static bool ValidTableId(uint32_t id) { return id >= 1 && id <= MAX_TABLE; }
+
+	static bool RegisterTable(uint32_t id, unordered_map<int, uint32_t> weights); // IDϷʱfalseḲñ
+
+	static bool HasTable(uint32_t id);
+
+	static bool SaveTable(const string& path, uint32_t id, const unordered_map<int, uint32_t>& weights);
+
+	static bool LoadTable(const string& path, uint32_t& id); // ļעᣬIDID 1~MAX_TABLE ʱʧ
+
+	// עı÷Լ MakeTable Ľʱͷд tableIdʱɵ÷ϳͬһű
+	static shared_ptr<HuffmanCode> MakeTable(unordered_map<int, uint32_t> weights); // ESCAPE
+
+	vector<char> Encode(const vector<int>& data, const HuffmanCode& table, uint32_t tableId);
+
+	vector<int> DecodeStatic(const vector<char>& bitSeq, const HuffmanCode& table);
+
+	uint64_t CodeLength(const unordered_map<int, uint32_t>& histogram) const; // ñMakeTableĽЩֵbit
+
 private:
+	void SetBitTable(); // valToCode -> λı룬̬
+
+	vector<int> DecodeStatic(const vector<char>& bitSeq, uint32_t tableId);
+
+	// startʼ룬һСstopֱ߽磨bitSizeΪֹ
+	// valsΪֵends[k]Ϊkֵbitλ
+	void DecodeRange(const unsigned char* bits, uint32_t bitSize, uint32_t start, uint32_t stop,
+		vector<int>& vals, vector<uint32_t>& ends) const;
+
+	static unordered_map<uint32_t, shared_ptr<HuffmanCode> >& Tables(); // עľ̬ID -> ı
+
+	static unordered_map<int, uint32_t> DefaultWeights();
+
+	unordered_map<int, pair<uint64_t, int> > valToBits; // val -> (, λ)ֻо̬
 	unordered_map<int, uint32_t> valToWeight; // valӦƵ&Ȩ
 	unordered_map<int, vector<char> > valToCode; // valӦ룬ı'0''1'ɣļbsuchar -> bit
 	HuffmanNode* treeRoot; // ڵ
@@ -0,0 +1,250 @@
+﻿#pragma warning(disable:4996)
+#include "opencv2/opencv.hpp"
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "iostream"
+#include "fstream"
+#include <functional>
+#ifdef _WIN32
+#include "Windows.h"
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#include "ImageCache.h"
+#include "ImageCodec.h"
+#include "Stats.h"
+
+ImageCache::ImageCache(size_t byteBudget, int shardNum) : budget(byteBudget), totalBytes(0), clock(0)
+{
+	if (shardNum <= 0)
+		shardNum = 1;
+	for (int i = 0; i < shardNum; i++)
+	{
+		shards.push_back(unique_ptr<Shard>(new Shard()));
+		shards.back()->bytes = 0;
+	}
+}
+
+// 文件的修改时间和大小，用作缓存键的一部分
+// 修改时间取到亚秒精度（Windows 100ns，其他平台 ns），同一秒内改写也能区分
+static bool FileVersion(const string& path, string& version)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &info))
+		return false;
+	unsigned long long mtime = ((unsigned long long)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+	unsigned long long size = ((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	version = to_string(mtime) + "|" + to_string(size);
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return false;
+	version = to_string((long long)info.st_mtim.tv_sec) + "." + to_string((long long)info.st_mtim.tv_nsec) + "|" + to_string((long long)info.st_size);
+#endif
+	return true;
+}
+
+shared_ptr<const Mat> ImageCache::Load(const string& path, double scale, Rect roi)
+{
+	string version;
+	if (!FileVersion(path, version))
+	{
+		cout << "Can not open file: " << path << endl;
+		return nullptr;
+	}
+
+	// 原图的键，文件改写后修改时间或大小会变
+	string baseKey = path + "|" + version;
+	bool whole = roi.width <= 0 || roi.height <= 0;
+	bool scaled = scale > 0 && scale != 1.0;
+	string key = baseKey;
+	if (!whole || scaled)
+		key += "|" + to_string(scaled ? scale : 1.0) + "|" + to_string(roi.x) + "," + to_string(roi.y) + ","
+			+ to_string(roi.width) + "," + to_string(roi.height);
+
+	shared_ptr<const Mat> image = Find(key);
+	if (image)
+	{
+		Stats::Add("image cache hits");
+		return image;
+	}
+	Stats::Add("image cache misses");
+
+	if (whole && !scaled)
+	{
+		// 解码在锁外做，同一文件被同时加载时可能解两次，Insert 保留先放进去的
+		image = DecodeFile(path);
+		return image ? Insert(key, image) : nullptr;
+	}
+
+	// 派生的结果从原图生成，原图也走缓存
+	shared_ptr<const Mat> base = Load(path);
+	if (!base)
+		return nullptr;
+
+	Mat region = *base;
+	if (!whole)
+	{
+		Rect clipped = roi & Rect(0, 0, base->cols, base->rows);
+		if (clipped.width <= 0 || clipped.height <= 0)
+			return nullptr;
+		region = (*base)(clipped);
+	}
+
+	Mat result;
+	if (scaled)
+	{
+		int w = (int)(region.cols * scale + 0.5), h = (int)(region.rows * scale + 0.5);
+		w = w > 0 ? w : 1;
+		h = h > 0 ? h : 1;
+		resize(region, result, Size(w, h), 0, 0, scale < 1.0 ? INTER_AREA : INTER_LINEAR);
+	}
+	else
+		result = region.clone(); // 单独一份，不会让原图被淘汰后还占着内存
+
+	return Insert(key, make_shared<const Mat>(result));
+}
+
+void ImageCache::Clear()
+{
+	for (size_t i = 0; i < shards.size(); i++)
+	{
+		lock_guard<mutex> guard(shards[i]->lock);
+		shards[i]->entries.clear();
+		shards[i]->index.clear();
+		totalBytes -= shards[i]->bytes;
+		shards[i]->bytes = 0;
+	}
+}
+
+size_t ImageCache::Bytes()
+{
+	return totalBytes;
+}
+
+ImageCache::Shard& ImageCache::ShardOf(const string& key)
+{
+	return *shards[hash<string>()(key) % shards.size()];
+}
+
+shared_ptr<const Mat> ImageCache::Find(const string& key)
+{
+	Shard& shard = ShardOf(key);
+	lock_guard<mutex> guard(shard.lock);
+	unordered_map<string, list<CacheEntry>::iterator>::iterator it = shard.index.find(key);
+	if (it == shard.index.end())
+		return nullptr;
+
+	// 移到表头
+	shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+	it->second->lastUse = ++clock;
+	return it->second->image;
+}
+
+shared_ptr<const Mat> ImageCache::Insert(const string& key, shared_ptr<const Mat> image)
+{
+	size_t bytes = Footprint(*image);
+	if (bytes > budget) // 比整个缓存还大，不缓存
+	{
+		Stats::Add("image cache oversized");
+		return image;
+	}
+
+	{
+		Shard& shard = ShardOf(key);
+		lock_guard<mutex> guard(shard.lock);
+		unordered_map<string, list<CacheEntry>::iterator>::iterator it = shard.index.find(key);
+		if (it != shard.index.end())
+		{
+			shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+			it->second->lastUse = ++clock;
+			return it->second->image;
+		}
+
+		CacheEntry entry;
+		entry.key = key;
+		entry.image = image;
+		entry.bytes = bytes;
+		entry.lastUse = ++clock;
+		shard.entries.push_front(entry);
+		shard.index[key] = shard.entries.begin();
+		shard.bytes += bytes;
+		totalBytes += bytes;
+	}
+
+	Evict();
+	return image;
+}
+
+void ImageCache::Evict()
+{
+	// 每个分片的表尾是该分片最久未用的，其中最旧的就是全局最久未用的
+	// 同一时刻只拿一把锁；挑出来之后表尾可能被别的线程动过，淘汰前再确认一次
+	// 调用方手里的 shared_ptr 不受影响
+	while (totalBytes > budget)
+	{
+		Shard* victim = nullptr;
+		uint64_t oldest = 0;
+		for (size_t i = 0; i < shards.size(); i++)
+		{
+			lock_guard<mutex> guard(shards[i]->lock);
+			if (!shards[i]->entries.empty() && (!victim || shards[i]->entries.back().lastUse < oldest))
+			{
+				victim = shards[i].get();
+				oldest = shards[i]->entries.back().lastUse;
+			}
+		}
+		if (!victim)
+			return;
+
+		lock_guard<mutex> guard(victim->lock);
+		if (victim->entries.empty() || victim->entries.back().lastUse != oldest)
+			continue;
+		CacheEntry& last = victim->entries.back();
+		victim->bytes -= last.bytes;
+		totalBytes -= last.bytes;
+		victim->index.erase(last.key);
+		victim->entries.pop_back();
+		Stats::Add("image cache evictions");
+	}
+}
+
+size_t ImageCache::Footprint(const Mat& image)
+{
+	// 灰度图的解码结果是补齐后整幅图上的ROI，缓存持有的是整块内存
+	if (image.datalimit > image.datastart)
+		return image.datalimit - image.datastart;
+	return image.total() * image.elemSize();
+}
+
+shared_ptr<const Mat> ImageCache::DecodeFile(const string& path)
+{
+	ifstream infile(path, ios::binary | ios::in);
+	if (!infile.is_open())
+	{
+		cout << "Can not open file: " << path << endl;
+		return nullptr;
+	}
+
+	// 目录等打得开但量不出大小的路径 tellg 为 -1 或极大值；长度字段都是32位的，更大的文件不合法
+	infile.seekg(0, ios::end);
+	streamoff length = infile.tellg();
+	if (length < 0 || length > 0x7fffffff)
+	{
+		cout << "Can not open file: " << path << endl;
+		return nullptr;
+	}
+	vector<char> data((size_t)length);
+	infile.seekg(0, ios::beg);
+	infile.read(data.data(), data.size());
+	if (infile.fail())
+		return nullptr;
+
+	Mat image = ImageCodec::Decode(data.data(), data.size());
+	if (image.empty())
+		return nullptr;
+	return make_shared<const Mat>(image);
+}
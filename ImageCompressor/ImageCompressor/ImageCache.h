@@ -0,0 +1,76 @@
+﻿/*
+	解压结果缓存：同一个文件反复打开时不再重新读取、解码
+
+	1、键为 路径 + 修改时间 + 文件大小 + 缩放比例 + ROI，文件被改写后自动失效
+	2、总字节数有上限，所有分片共用，超出时淘汰各分片表尾中最久未用的（近似全局LRU）
+	3、按键的哈希分片加锁，多个线程同时读不会都挤在一把锁上
+	4、返回共享的只读图像，命中时不拷贝像素；要修改像素须先clone
+
+	命中/未命中/淘汰次数通过 Stats 计数
+*/
+#pragma once
+#include "opencv2/opencv.hpp"
+#include "opencv2/core/core.hpp"
+#include "iostream"
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+using namespace cv;
+using namespace std;
+
+class ImageCache
+{
+public:
+	// byteBudget 为所有分片共用的上限，不超过它的结果都能缓存；shardNum 为分片（锁）个数
+	ImageCache(size_t byteBudget, int shardNum = 16);
+
+	// 读入压缩文件并解码，scale 为缩放比例，roi 为原图坐标下的区域（宽高为0表示整幅图）
+	// 先截取ROI再缩放；派生的结果从缓存的原图生成，不重新解码。失败返回空指针
+	shared_ptr<const Mat> Load(const string& path, double scale = 1.0, Rect roi = Rect());
+
+	void Clear();
+
+	size_t Bytes(); // 当前缓存的总字节数
+
+	size_t Budget() const { return budget; }
+
+private:
+	struct CacheEntry
+	{
+		string key;
+		shared_ptr<const Mat> image;
+		size_t bytes;
+		uint64_t lastUse; // 最近一次使用的序号，跨分片比较新旧
+	};
+
+	struct Shard
+	{
+		mutex lock;
+		list<CacheEntry> entries; // 表头为最近使用
+		unordered_map<string, list<CacheEntry>::iterator> index;
+		size_t bytes;
+	};
+
+	Shard& ShardOf(const string& key);
+
+	shared_ptr<const Mat> Find(const string& key);
+
+	// 放入缓存并按需淘汰；已有同键的条目时返回已有的
+	shared_ptr<const Mat> Insert(const string& key, shared_ptr<const Mat> image);
+
+	void Evict(); // 总字节数超出上限时，从各分片表尾中挑最久未用的淘汰
+
+	static size_t Footprint(const Mat& image); // 实际占用的内存，ROI按整块分配的大小算
+
+	static shared_ptr<const Mat> DecodeFile(const string& path);
+
+	size_t budget;
+	atomic<size_t> totalBytes;
+	atomic<uint64_t> clock;
+	vector<unique_ptr<Shard> > shards;
+};
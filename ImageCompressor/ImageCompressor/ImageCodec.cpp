@@ -0,0 +1,263 @@
+﻿#include "opencv2/opencv.hpp"
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "iostream"
+
+#include "ImageCodec.h"
+#include "HuffmanCode.h"
+#include "DCT.h"
+#include "Order.h"
+#include "Stats.h"
+
+vector<Mat> ImageCodec::SplitChannels(Mat src)
+{
+	MemStage stage(STAGE_SPLIT);
+	vector<Mat> channels;
+	if (src.channels() == 3)
+	{
+		Mat ycrcbImage;
+		cvtColor(src, ycrcbImage, COLOR_BGR2YCrCb);
+
+		// 分离通道
+		split(ycrcbImage, channels);
+		channels[1] = Subsample(channels[1], 2); // Cr Cb下采样，4:2:0
+		channels[2] = Subsample(channels[2], 2);
+	}
+	else
+		channels.push_back(src);
+
+	return channels;
+}
+
+template<int N>
+vector<int> ImageCodec::TransformChannel(Mat channel)
+{
+	BlockDCT<N> quantizer;
+
+	// DCT
+	MemStage dctStage(STAGE_DCT);
+	Mat dctImg = quantizer.DCTNxN(channel); // dct + quantization
+	Stats::Add("blocks", dctImg.rows / N * (dctImg.cols / N));
+	Stats::Add("flat blocks skipped", quantizer.SkippedBlocks());
+
+	// order + RLE
+	// 没有把DC和AC分开，如果分开的话DC和AC编码表不一样，但是我又不用JPEG的做，感觉。。。意义不大
+	MemStage orderStage(STAGE_ORDER);
+	CountedVector<int> orderData;
+	for (int y = 0; y < dctImg.rows; y += N)
+	{
+		for (int x = 0; x < dctImg.cols; x += N)
+		{
+			Mat block = dctImg(Rect(x, y, N, N));
+			vector<int> tmp = Order::ZigZag<N>(block);
+			orderData.insert(orderData.end(), tmp.begin(), tmp.end());
+		}
+	}
+	//cout << "origin size: " << orderData.size() << endl;
+	return Order::RLE_Encode(orderData.data(), orderData.size());
+}
+
+template vector<int> ImageCodec::TransformChannel<4>(Mat);
+template vector<int> ImageCodec::TransformChannel<8>(Mat);
+template vector<int> ImageCodec::TransformChannel<16>(Mat);
+
+vector<char> ImageCodec::Encode(Mat src, int tableId, int blockSize)
+{
+	// 获得图像的通道数、大小
+	vector<char> head;
+	int channel = src.channels();
+	int row = src.rows;
+	int col = src.cols;
+	if (blockSize != 4 && blockSize != 16) // 其他值都按8
+		blockSize = 8;
+
+	// 块大小记在通道数的高16位，8记为0，与旧文件一致
+	int channelField = channel | (blockSize == 8 ? 0 : blockSize << 16);
+	char *p = reinterpret_cast<char*>(&channelField);
+	for (int i = 0; i < 4; i++)
+		head.push_back(*(p + i));
+	p = reinterpret_cast<char*>(&row);
+	for (int i = 0; i < 4; i++)
+		head.push_back(*(p + i));
+	p = reinterpret_cast<char*>(&col);
+	for (int i = 0; i < 4; i++)
+		head.push_back(*(p + i));
+
+	// 彩色图像分离RGB通道->YCrCb，作为压缩的单元
+	vector<Mat> channels = SplitChannels(src);
+
+	// 输出的字节流
+	vector<char> result(head.begin(), head.end());
+
+	for (int i = 0; i < channel; i++)
+	{
+		// DCT + order + RLE
+		vector<int> orderData = blockSize == 4 ? TransformChannel<4>(channels[i])
+			: blockSize == 16 ? TransformChannel<16>(channels[i]) : TransformChannel<8>(channels[i]);
+
+		AppendChannel(result, orderData, tableId);
+	}
+
+	return result;
+}
+
+void ImageCodec::AppendChannel(vector<char>& result, const vector<int>& orderData, int tableId)
+{
+	HuffmanCode encoder;
+
+	// Huffman Encoding，tableId < 0 时按本通道统计建表
+	MemStage stage(STAGE_HUFFMAN_ENC);
+	vector<char> bitSeq = tableId < 0 ? encoder.Encode(orderData) : encoder.Encode(orderData, tableId); // 编码得到的输出值
+
+	int curSize = bitSeq.size(); // 当前通道的大小
+	char* p = reinterpret_cast<char*>(&curSize);
+	for (int k = 0; k < 4; k++)
+		result.push_back(*(p + k)); // 1. size
+	result.insert(result.end(), bitSeq.begin(), bitSeq.end()); // 2. data
+}
+
+bool ImageCodec::ReadHeader(const char* data, size_t size, int& channel, int& row, int& col)
+{
+	int blockSize;
+	return ReadHeader(data, size, channel, row, col, blockSize);
+}
+
+bool ImageCodec::ReadHeader(const char* data, size_t size, int& channel, int& row, int& col, int& blockSize)
+{
+	// 读头 channel | row | col | 1 | 2 | ...
+	if (size < 12)
+		return false;
+	memcpy(&channel, data, 4);
+	memcpy(&row, data + 4, 4);
+	memcpy(&col, data + 8, 4);
+	blockSize = (unsigned)channel >> 16;
+	blockSize = blockSize == 0 ? 8 : blockSize;
+	channel &= 0xFFFF;
+
+	return (channel == 1 || channel == 3) && row > 0 && col > 0
+		&& (blockSize == 4 || blockSize == 8 || blockSize == 16);
+}
+
+Mat ImageCodec::Decode(const char* data, size_t size, int threadNum)
+{
+	int channel, row, col, blockSize;
+	if (!ReadHeader(data, size, channel, row, col, blockSize))
+		return Mat();
+
+	if (blockSize == 4)
+		return DecodeBlocks<4>(data, size, channel, row, col, threadNum);
+	if (blockSize == 16)
+		return DecodeBlocks<16>(data, size, channel, row, col, threadNum);
+	return DecodeBlocks<8>(data, size, channel, row, col, threadNum);
+}
+
+template<int N>
+Mat ImageCodec::DecodeBlocks(const char* data, size_t size, int channel, int row, int col, int threadNum)
+{
+	// 原图的大小，填充
+	int pRow = BlockDCT<N>::Padded(row);
+	int pCol = BlockDCT<N>::Padded(col);
+
+	vector<Mat> channels; // 合成
+
+	size_t fp = 12; // 读取字节流
+	// 解析通道
+	for (int i = 0; i < channel; i++)
+	{
+		int cSize; // 通道字节数
+		if (fp + 4 > size)
+			return Mat();
+		memcpy(&cSize, data + fp, 4);
+		fp += 4;
+		if (cSize < 8 || fp + cSize > size)
+			return Mat();
+
+		HuffmanCode decoder;
+		BlockDCT<N> quantizer;
+		// Huffman解码
+		MemStage huffmanStage(STAGE_HUFFMAN_DEC);
+		vector<char> curData(data + fp, data + fp + cSize);
+		vector<int> decodeData = decoder.DecodeParallel(curData, threadNum);
+		if (decodeData.empty())
+			return Mat();
+
+		if (i != 0)
+		{
+			pRow = BlockDCT<N>::Padded(row / 2);
+			pCol = BlockDCT<N>::Padded(col / 2);
+		}
+
+		// RLE解码 + izigzag，系数个数由块数确定
+		MemStage orderStage(STAGE_IORDER);
+		CountedVector<int> reorderData = Order::RLE_Decode(decodeData, (size_t)pRow * pCol);
+		//cout << "reorder size: " << reorderData.size() << endl;
+		if (reorderData.empty())
+			return Mat();
+		Mat	reMat = Mat::zeros(pRow, pCol, CV_32SC1);
+
+		int cnt = 0;
+		for (int y = 0; y < pRow; y += N)
+		{
+			for (int x = 0; x < pCol; x += N)
+			{
+				vector<int> tmpV(reorderData.begin() + cnt * N * N, reorderData.begin() + (cnt + 1) * N * N);
+				Mat tmp = Order::iZigZag<N>(tmpV);
+				tmp.copyTo(reMat(Rect(x, y, N, N)));
+				cnt++;
+			}
+		}
+
+		// idct
+		MemStage idctStage(STAGE_IDCT);
+		Mat idct = quantizer.iDCTNxN(reMat);
+		Stats::Add("flat blocks filled", quantizer.SkippedBlocks());
+		channels.push_back(idct);
+
+		fp += cSize;
+	}
+
+	return MergeChannels(channels, row, col);
+}
+
+Mat ImageCodec::MergeChannels(vector<Mat> channels, int row, int col)
+{
+	// 组合成 RGB 图像
+	MemStage stage(STAGE_MERGE);
+	Mat grayRGBImage;
+	int channel = channels.size();
+	if (channel == 3)
+	{
+		channels[0] = channels[0](Range(0, row), Range(0, col));
+		channels[1] = channels[1](Range(0, row / 2), Range(0, col / 2));
+		channels[2] = channels[2](Range(0, row / 2), Range(0, col / 2));
+		// 对Cr通道进行双线性插值
+		resize(channels[1], channels[1], Size(col, row), INTER_LINEAR);
+		// 对Cb通道进行双线性插值
+		resize(channels[2], channels[2], Size(col, row), INTER_LINEAR);
+
+		merge(channels, grayRGBImage);
+		cvtColor(grayRGBImage, grayRGBImage, COLOR_YCrCb2BGR);
+	}
+	else
+		grayRGBImage = channels[0](Range(0, row), Range(0, col));
+
+	return grayRGBImage;
+}
+
+Mat ImageCodec::Subsample(Mat img, int factor)
+{
+	int output_width = img.cols / factor;
+	int output_height = img.rows / factor;
+	Mat output(output_height, output_width, img.type());
+
+	for (int i = 0; i < output_height; ++i)
+	{
+		for (int j = 0; j < output_width; ++j)
+		{
+			output.at<uchar>(i, j) = img.at<uchar>(i * factor, j * factor);
+		}
+	}
+
+	return output;
+}
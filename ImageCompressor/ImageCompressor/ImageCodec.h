@@ -0,0 +1,45 @@
+﻿/*
+	图像 <-> 压缩字节流，不涉及文件读写，单文件压缩和归档共用
+
+	<字节流格式>
+	通道数 | rows | cols | 通道1大小 | 通道1数据 | 通道2大小 | ...
+	通道数的高16位为块大小（4/8/16），0表示8
+*/
+#pragma once
+#include "opencv2/opencv.hpp"
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "iostream"
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+class ImageCodec
+{
+public:
+	static vector<char> Encode(Mat src, int tableId = -1, int blockSize = 8); // 压缩，tableId < 0 时每个通道单独建Huffman表
+
+	// 解压，失败返回空Mat；threadNum 为Huffman解码的线程数，0 表示按CPU核数，已在多线程里调用时传1
+	static Mat Decode(const char* data, size_t size, int threadNum = 0);
+
+	static bool ReadHeader(const char* data, size_t size, int& channel, int& row, int& col); // 只读头
+
+	static bool ReadHeader(const char* data, size_t size, int& channel, int& row, int& col, int& blockSize);
+
+	static vector<Mat> SplitChannels(Mat src); // 彩色转YCrCb并下采样色度，灰度图直接作为一个通道
+
+	template<int N = 8>
+	static vector<int> TransformChannel(Mat channel); // DCT + 量化 + zigzag + RLE，块大小NxN
+
+	static void AppendChannel(vector<char>& result, const vector<int>& orderData, int tableId); // Huffman编码一个通道，追加 大小 | 数据
+
+	static Mat MergeChannels(vector<Mat> channels, int row, int col); // iDCT后的各通道裁掉填充、上采样色度并转回BGR
+
+	static Mat Subsample(Mat img, int factor);
+
+private:
+	template<int N>
+	static Mat DecodeBlocks(const char* data, size_t size, int channel, int row, int col, int threadNum);
+};
@@ -5,6 +5,7 @@
 #include "opencv2/imgproc/imgproc.hpp"
 #include "iostream"
 #include "fstream"
+#include "regex"
 #include "string.h"
 #include "Windows.h"
 #include <opencv2/highgui/highgui_c.h>
@@ -13,6 +14,13 @@
 #include "HuffmanCode.h"
 #include "DCT.h"
 #include "Order.h"
+#include "ImageCodec.h"
+#include "Archive.h"
+#include "Pipeline.h"
+#include "Stats.h"
+#include "ImageCache.h"
+#include "Sequence.h"
+#include "JpegTranscoder.h"
 
 
 using namespace cv;
@@ -21,93 +29,31 @@ using namespace std;
 /*
 	<文件格式>
 	通道数 | rows | cols | 通道1大小 | 通道1数据 | 通道2大小 | ...
+	通道数的高16位为块大小（4/8/16），0表示8
 */
 
-Mat Subsample(Mat img, int factor);
-
-// 压缩
-void Compress(string srcPath, string dstPath)
+// 压缩，tableId: -1 为每个通道单独建表，否则用对应ID的静态Huffman表
+void Compress(string srcPath, string dstPath, int tableId = -1, int blockSize = 8)
 {
 	cout << "Compressing..." << endl;
 
-	Mat src = imread(srcPath, IMREAD_UNCHANGED);
-	if (!src.data)  //判断是否有数据
-	{
-		cout << "Can not open file!" << endl;
-		system("pause");
-		return;
-	}
-
-	// 获得图像的通道数、大小
-	vector<char> head;
-	int channel = src.channels();
-	int row = src.rows;
-	int col = src.cols;
-
-	char *p = reinterpret_cast<char*>(&channel);
-	for (int i = 0; i < 4; i++)
-		head.push_back(*(p + i));
-	p = reinterpret_cast<char*>(&row);
-	for (int i = 0; i < 4; i++)
-		head.push_back(*(p + i));
-	p = reinterpret_cast<char*>(&col);
-	for (int i = 0; i < 4; i++)
-		head.push_back(*(p + i));
-
-	// 彩色图像分离RGB通道->YCrCb，作为压缩的单元
-	vector<Mat> channels;
-	if (channel == 3)
-	{
-		Mat ycrcbImage;
-		cvtColor(src, ycrcbImage, COLOR_BGR2YCrCb);
-
-		// 分离通道
-		
-		split(ycrcbImage, channels);
-		channels[1] = Subsample(channels[1], 2); // Cr Cb下采样，4:2:0
-		channels[2] = Subsample(channels[2], 2);
-	}
+	// JPEG直接用里面的DCT系数，不能转的再按像素压缩
+	vector<char> result;
+	if (blockSize == 8)
+		result = JpegTranscoder::TranscodeFile(srcPath, tableId);
+	if (!result.empty())
+		cout << "Transcoded from JPEG coefficients." << endl;
 	else
-		channels.push_back(src);
-
-	//cout << channel;
-
-	// 输出的字节流
-	vector<char> result(head.begin(), head.end());
-
-	for (int i = 0; i < channel; i++)
 	{
-		int curSize; // 当前通道的大小
-		DCT quantizer;
-		HuffmanCode encoder;
-
-		// DCT
-		Mat dctImg = quantizer.DCT8x8(channels[i]); // dct + quantization
-
-		// order + RLE
-		// 没有把DC和AC分开，如果分开的话DC和AC编码表不一样，但是我又不用JPEG的做，感觉。。。意义不大
-		vector<int> orderData;
-		for (int y = 0; y < dctImg.rows; y += 8)
+		Mat src = imread(srcPath, IMREAD_UNCHANGED);
+		if (!src.data)  //判断是否有数据
 		{
-			for (int x = 0; x < dctImg.cols; x += 8)
-			{
-				Mat block = dctImg(Rect(x, y, 8, 8));
-				vector<int> tmp = Order::ZigZag(block);
-				orderData.insert(orderData.end(), tmp.begin(), tmp.end());
-			}
+			cout << "Can not open file!" << endl;
+			system("pause");
+			return;
 		}
-		//cout << "origin size: " << orderData.size() << endl;
-		orderData = Order::RLE_Encode(orderData);
-		//cout << "ordered size: " << orderData.size() << endl;
 
-		// Huffman Encoding
-		vector<char> bitSeq = encoder.Encode(orderData); // 编码得到的输出值
-		
-		curSize = bitSeq.size();
-		p = reinterpret_cast<char*>(&curSize);
-		for (int k = 0; k < 4; k++)
-			result.push_back(*(p + k)); // 1. size
-		result.insert(result.end(), bitSeq.begin(), bitSeq.end()); // 2. data
+		result = ImageCodec::Encode(src, tableId, blockSize);
 	}
 
 	// 保存文件
@@ -118,113 +64,193 @@ void Compress(string srcPath, string dstPath)
 	cout << "\nCompressed image saved! Total size: " << result.size() << " Bytes." << endl;
 }
 
-// 解压
-Mat Decompress(string path)
+// 解压结果缓存，反复打开同一文件时直接取缓存
+ImageCache imageCache(256 << 20);
+
+// 解压，scale 为缩放比例，roi 为原图中的区域（宽高为0表示整幅图）
+// 结果与缓存共用像素，只读，失败返回空指针
+shared_ptr<const Mat> Decompress(string path, double scale = 1.0, Rect roi = Rect())
 {
 	cout << "Loading..." << endl;
 
-	// 打开并解码文件
-	ifstream infile(path, ios::binary | ios::in);
-	if (!infile.is_open())
+	shared_ptr<const Mat> image = imageCache.Load(path, scale, roi);
+	if (!image)
 	{
-		cout << "Invalid path!" << endl;
-		system("pause");
-		return Mat_<double>();
+		cout << "Invalid file!" << endl;
+		return nullptr;
 	}
 
-	infile.seekg(0, ios::end);
-	int size = infile.tellg();
-	infile.seekg(0, ios::beg);
-	vector<char> read_data(size);
-	infile.read(read_data.data(), read_data.size());
-	infile.close();
-
-	// 读头 channel | row | col | 1 | 2 | ...
-	char pdata[4]{read_data[0], read_data[1], read_data[2], read_data[3]};
-	int *p = reinterpret_cast<int*>(pdata);
-	int channel = *p; // 1.
-	for (int i = 0; i < 4; i++)
-		pdata[i] = read_data[4+i];
-	int row = *p; // 2.
-	for (int i = 0; i < 4; i++)
-		pdata[i] = read_data[8 + i];
-	int col = *p; // 3.
-	
-	// 原图的大小，填充
-	int pRow = row % 8 == 0 ? row : row + 8 - row % 8;
-	int pCol = col % 8 == 0 ? col : col + 8 - col % 8;
-
-	vector<Mat> channels; // 合成
-
-	int fp = 12; // 读取字节流
-	// 解析通道
-	for (int i = 0; i < channel; i++)
+	cout << "Image loaded!" << endl;
+	return image;
+}
+
+// 把一组图片按顺序压缩成序列
+void CompressSequence(const vector<string>& srcPaths, string dstPath, int keyInterval, int tableId)
+{
+	SequenceWriter writer(keyInterval);
+	if (!writer.Open(dstPath))
 	{
-		for (int j = 0; j < 4; j++)
-			pdata[j] = read_data[fp++];
-		int cSize = *p; // 通道字节数
+		cout << "Can not open file!" << endl;
+		return;
+	}
 
-		HuffmanCode decoder;
-		DCT quantizer;
-		// Huffman解码
-		vector<char> curData(read_data.begin()+fp, read_data.begin() + fp+cSize);
-		vector<int> decodeData = decoder.Decode(curData);
+	int done = 0;
+	for (int i = 0; i < srcPaths.size(); i++)
+	{
+		Mat frame = imread(srcPaths[i], IMREAD_UNCHANGED);
+		if (!frame.data)
+			cout << "Can not open file: " << srcPaths[i] << endl;
+		else if (!writer.Append(frame, tableId))
+			cout << "Frame size or channels differ from the first frame: " << srcPaths[i] << endl;
+		else
+			done++;
+	}
 
-		// RLE解码 + izigzag
-		vector<int> reorderData = Order::RLE_Decode(decodeData);
-		//cout << "reorder size: " << reorderData.size() << endl;
+	if (!writer.Close())
+		cout << "Failed to write sequence index!" << endl;
+	cout << "\n" << done << " frames compressed." << endl;
+}
 
-		if (i != 0)
-		{
-			pRow = (row / 2) % 8 == 0 ? (row / 2) : (row / 2) + 8 - (row / 2) % 8;
-			pCol = (col / 2) % 8 == 0 ? (col / 2) : (col / 2) + 8 - (col / 2) % 8;
-		}
-		Mat	reMat = Mat::zeros(pRow, pCol, CV_32SC1);
+// 解析表ID，只接受 1~65535，位数太多时不调用stoi，免得抛异常
+bool ParseTableId(const string& input, uint32_t& id)
+{
+	if (!regex_match(input, regex("[0-9]{1,5}")))
+		return false;
+	id = stoi(input);
+	return HuffmanCode::ValidTableId(id);
+}
 
-		int cnt = 0;
-		for (int y = 0; y < pRow; y += 8)
+// 从样本图片离线训练静态Huffman表，保存到文件并注册
+// 按压缩时的块大小和路径统计：块大小为8时JPEG取转码的系数，其他按像素变换
+void TrainTable(int blockSize)
+{
+	string input, tablePath, srcPath;
+	uint32_t id = 0;
+	cout << "\nInput table ID (1~65535)>";
+	getline(cin, input);
+	if (!ParseTableId(input, id))
+	{
+		cout << "Table ID must be 1~65535!" << endl;
+		return;
+	}
+	cout << "\nInput table save path>";
+	getline(cin, tablePath);
+
+	HuffmanCode trainer;
+	int count = 0;
+	cout << "\nInput sample image paths, one per line, empty line to finish" << endl;
+	while (getline(cin, srcPath) && !srcPath.empty())
+	{
+		vector<vector<int> > orderData;
+		if (blockSize != 8 || !JpegTranscoder::TransformFile(srcPath, orderData))
 		{
-			for (int x = 0; x < pCol; x += 8)
+			Mat src = imread(srcPath, IMREAD_UNCHANGED);
+			if (!src.data)
 			{
-				vector<int> tmpV(reorderData.begin() + cnt * 64, reorderData.end());
-				Mat tmp = Order::iZigZag(tmpV);
-				tmp.copyTo(reMat(Rect(x, y, 8, 8)));
-				cnt++;
+				cout << "Can not open file!" << endl;
+				continue;
 			}
+
+			vector<Mat> channels = ImageCodec::SplitChannels(src);
+			for (int i = 0; i < channels.size(); i++)
+				orderData.push_back(blockSize == 4 ? ImageCodec::TransformChannel<4>(channels[i])
+					: blockSize == 16 ? ImageCodec::TransformChannel<16>(channels[i]) : ImageCodec::TransformChannel<8>(channels[i]));
 		}
 
-		// idct
-		Mat idct = quantizer.iDCT8x8(reMat);
-		channels.push_back(idct);
+		for (int i = 0; i < orderData.size(); i++)
+			trainer.SetWeightTable(orderData[i]); // 频率累加
+		count++;
+	}
 
-		fp += cSize;
+	if (count == 0 || !HuffmanCode::SaveTable(tablePath, id, trainer.GetWeightTable()))
+	{
+		cout << "Training failed!" << endl;
+		return;
 	}
+	HuffmanCode::RegisterTable(id, trainer.GetWeightTable());
+	cout << "\nTable " << id << " trained from " << count << " images (block size " << blockSize << "), "
+		<< trainer.GetWeightTable().size() << " symbols." << endl;
+}
 
-	// 组合成 RGB 图像 
-	Mat grayRGBImage;
-	if (channel == 3)
+// 选择压缩时用的Huffman表：-1 自适应，0 内置表，或者读入训练好的表文件
+int SelectTable(int current)
+{
+	string input;
+	cout << "\nCurrent table: " << current << endl;
+	cout << "Input -1 (adaptive), 0 (built-in), a loaded table ID, or a table file path>";
+	getline(cin, input);
+
+	uint32_t id;
+	if (regex_match(input, regex("-?[0-9]+")))
 	{
-		channels[0] = channels[0](Range(0, row), Range(0, col));
-		channels[1] = channels[1](Range(0,row/2), Range(0,col/2));
-		channels[2] = channels[2](Range(0, row / 2), Range(0, col / 2));
-		// 对Cr通道进行双线性插值
-		resize(channels[1], channels[1], Size(col, row), INTER_LINEAR);
-		// 对Cb通道进行双线性插值
-		resize(channels[2], channels[2], Size(col, row), INTER_LINEAR);
-		
-		merge(channels, grayRGBImage);
-		cvtColor(grayRGBImage, grayRGBImage, COLOR_YCrCb2BGR);
+		if (input[0] == '-')
+			return -1;
+		if (regex_match(input, regex("0+")))
+			return HuffmanCode::DEFAULT_TABLE;
+		if (ParseTableId(input, id) && HuffmanCode::HasTable(id))
+			return id;
+		cout << "Table not loaded!" << endl;
+		return current;
 	}
-	else
-		grayRGBImage = channels[0](Range(0,row), Range(0,col));
 
-	cout << "Image loaded!" << endl;
-	return grayRGBImage;
+	if (!HuffmanCode::LoadTable(input, id))
+	{
+		cout << "Can not open table file, or its ID is not 1~65535!" << endl;
+		return current;
+	}
+	cout << "Table " << id << " loaded." << endl;
+	return id;
+}
+
+// 批量压缩进归档：读、压缩、写走流水线，按输入顺序追加
+void CompressToArchive(const vector<string>& srcPaths, string archivePath, int tableId, int blockSize)
+{
+	ArchiveWriter writer;
+	if (!writer.Open(archivePath))
+	{
+		cout << "Can not open archive!" << endl;
+		return;
+	}
+
+	vector<pair<string, string> > jobs;
+	for (int i = 0; i < srcPaths.size(); i++)
+		jobs.push_back(make_pair(srcPaths[i], srcPaths[i]));
+
+	Pipeline pipeline(Pipeline::COMPRESS);
+	pipeline.SetTable(tableId);
+	pipeline.SetBlockSize(blockSize);
+	pipeline.SetArchive(&writer);
+	int done = pipeline.Run(jobs);
+
+	if (!writer.Close())
+		cout << "Failed to write archive index!" << endl;
+	cout << "\n" << done << " images added to archive." << endl;
+}
+
+// 批量压缩/解压到目录，输出文件名为 原文件名 + 后缀
+void BatchProcess(const vector<string>& srcPaths, string dstDir, Pipeline::Mode mode, int tableId, int blockSize)
+{
+	vector<pair<string, string> > jobs;
+	for (int i = 0; i < srcPaths.size(); i++)
+	{
+		size_t slash = srcPaths[i].find_last_of("/\\");
+		string name = slash == string::npos ? srcPaths[i] : srcPaths[i].substr(slash + 1);
+		jobs.push_back(make_pair(srcPaths[i], dstDir + "/" + name + (mode == Pipeline::COMPRESS ? ".dat" : ".png")));
+	}
+
+	Pipeline pipeline(mode);
+	pipeline.SetTable(tableId);
+	pipeline.SetBlockSize(blockSize);
+	int done = pipeline.Run(jobs);
+
+	cout << "\n" << done << " of " << jobs.size() << " files processed." << endl;
 }
 
 int main()
 {
 	utils::logging::setLogLevel(utils::logging::LOG_LEVEL_SILENT);
+	int tableId = -1; // 压缩用的Huffman表
+	int blockSize = 8; // 压缩用的块大小
 
 	while (1)
 	{
@@ -232,11 +258,23 @@ int main()
 		int choice = 0;
 		cout << "1 --- Open an image and compress" << endl;
 		cout << "2 --- Load a compressed file and show image" << endl;
+		cout << "3 --- Train a Huffman table from sample images (for the current block size)" << endl;
+		cout << "4 --- Select Huffman table for compression" << endl;
+		cout << "5 --- Compress images into an archive" << endl;
+		cout << "6 --- Load an image from an archive and show" << endl;
+		cout << "7 --- Batch compress images into a directory" << endl;
+		cout << "8 --- Batch decompress files into a directory" << endl;
+		cout << "9 --- Turn statistics " << (Stats::Enabled() ? "off" : "on") << endl;
+		cout << "10 --- Load a region of a compressed file and show" << endl;
+		cout << "11 --- Compress an image sequence" << endl;
+		cout << "12 --- Load a frame from a sequence and show" << endl;
+		cout << "13 --- Select block size for compression (current " << blockSize << ")" << endl;
 		cout << "0 --- Quit" << endl;
 		cin >> choice;
 		cin.get();
 
 		if (choice == 0) break;
+		Stats::Reset();
 		
 		if (choice == 1) // 读取图片并压缩
 		{
@@ -248,51 +286,149 @@ int main()
 			cout << "\nInput save path>";
 			getline(cin, dstPath);
 
-			Compress(srcPath, dstPath);
+			Compress(srcPath, dstPath, tableId, blockSize);
+			Stats::Print();
 		}
 
-		else if (choice == 2) // 读取压缩文件
+		else if (choice == 2 || choice == 6 || choice == 10 || choice == 12) // 读取压缩文件 / 从归档读取 / 读取局部 / 读取序列帧
 		{
 			// 解压图片，从path读入
 			string path;
 			cout << "\nInput file path>";
 			getline(cin, path);
-			Mat dst = Decompress(path);
-			if (dst.type() != 0)
+			shared_ptr<const Mat> dst; // 从缓存来的结果只读
+			Mat loaded; // 归档、序列读出的结果
+			if (choice == 2)
+				dst = Decompress(path);
+			else if (choice == 10)
+			{
+				double scale = 1.0;
+				Rect roi;
+				cout << "\nInput scale>";
+				cin >> scale;
+				cout << "\nInput region: x y width height (0 0 0 0 for whole image)>";
+				cin >> roi.x >> roi.y >> roi.width >> roi.height;
+				cin.get();
+				dst = Decompress(path, scale, roi);
+			}
+			else if (choice == 12)
+			{
+				SequenceReader reader;
+				int frame = 0;
+				cout << "\nInput frame number>";
+				cin >> frame;
+				cin.get();
+				if (!reader.Open(path))
+					cout << "Invalid sequence!" << endl;
+				else if ((loaded = reader.Load(frame)).empty())
+					cout << "Frame not found!" << endl;
+			}
+			else
+			{
+				ArchiveReader reader;
+				string name;
+				cout << "\nInput image name>";
+				getline(cin, name);
+				if (!reader.Open(path))
+					cout << "Invalid archive!" << endl;
+				else if ((loaded = reader.Load(name)).empty())
+					cout << "Image not found!" << endl;
+			}
+			if (!loaded.empty())
+				dst = make_shared<const Mat>(loaded);
+			Stats::Print();
+			if (!dst || dst->empty())
 				continue;
 			namedWindow("Image", WINDOW_NORMAL);
 			cout << "\nPress <ESC> to exit\n";
-			imshow("Image", dst);
+			imshow("Image", *dst);
 			while (1)
 				if (waitKey() == 27) break;
 			destroyAllWindows();
 			//waitKey(0);
 		}
 
-		else
+		else if (choice == 5) // 批量压缩进归档
 		{
-			cout << "Invalid input!" << endl;
+			string archivePath, srcPath;
+			vector<string> srcPaths;
+			cout << "\nInput archive path>";
+			getline(cin, archivePath);
+			cout << "\nInput source image paths, one per line, empty line to finish" << endl;
+			while (getline(cin, srcPath) && !srcPath.empty())
+				srcPaths.push_back(srcPath);
+
+			CompressToArchive(srcPaths, archivePath, tableId, blockSize);
+			Stats::Print();
 		}
-	}
 
-	//system("pause");
-	return 0;
-}
+		else if (choice == 7 || choice == 8) // 批量压缩/解压
+		{
+			string dstDir, srcPath;
+			vector<string> srcPaths;
+			cout << "\nInput output directory>";
+			getline(cin, dstDir);
+			cout << "\nInput source paths, one per line, empty line to finish" << endl;
+			while (getline(cin, srcPath) && !srcPath.empty())
+				srcPaths.push_back(srcPath);
+
+			BatchProcess(srcPaths, dstDir, choice == 7 ? Pipeline::COMPRESS : Pipeline::DECOMPRESS, tableId, blockSize);
+			Stats::Print();
+		}
 
+		else if (choice == 11) // 压缩图像序列
+		{
+			string dstPath, srcPath;
+			vector<string> srcPaths;
+			int keyInterval = 30;
+			cout << "\nInput save path>";
+			getline(cin, dstPath);
+			cout << "\nInput key frame interval>";
+			cin >> keyInterval;
+			cin.get();
+			cout << "\nInput frame paths in order, one per line, empty line to finish" << endl;
+			while (getline(cin, srcPath) && !srcPath.empty())
+				srcPaths.push_back(srcPath);
+
+			CompressSequence(srcPaths, dstPath, keyInterval, tableId);
+			Stats::Print();
+		}
 
-Mat Subsample(Mat img, int factor)
-{
-	int output_width = img.cols / factor;
-	int output_height = img.rows / factor;
-	Mat output(output_height, output_width, img.type());
+		else if (choice == 9) // 统计开关
+		{
+			Stats::Enable(!Stats::Enabled());
+			cout << "Statistics " << (Stats::Enabled() ? "on" : "off") << endl;
+		}
 
-	for (int i = 0; i < output_height; ++i) 
-	{
-		for (int j = 0; j < output_width; ++j) 
+		else if (choice == 3) // 训练静态表
+		{
+			TrainTable(blockSize);
+		}
+
+		else if (choice == 4) // 选择静态表
+		{
+			tableId = SelectTable(tableId);
+		}
+
+		else if (choice == 13) // 选择块大小
 		{
-			output.at<uchar>(i, j) = img.at<uchar>(i * factor, j * factor);
+			int size = 0;
+			cout << "\nInput block size (4, 8 or 16)>";
+			cin >> size;
+			cin.get();
+			if (size == 4 || size == 8 || size == 16)
+				blockSize = size;
+			else
+				cout << "Invalid block size!" << endl;
+		}
+
+		else
+		{
+			cout << "Invalid input!" << endl;
 		}
 	}
 
-	return output;
-}
\ No newline at end of file
+	//system("pause");
+	return 0;
+}
+
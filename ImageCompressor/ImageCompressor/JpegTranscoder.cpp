@@ -0,0 +1,228 @@
+﻿#include "opencv2/opencv.hpp"
+#include "opencv2/core/core.hpp"
+#include "iostream"
+#include "fstream"
+#ifdef IC_WITH_LIBJPEG
+#include <stdio.h>
+#include <setjmp.h>
+#include "jpeglib.h"
+#endif
+
+#include "JpegTranscoder.h"
+#include "ImageCodec.h"
+#include "DCT.h"
+#include "Order.h"
+#include "Stats.h"
+
+#ifdef IC_WITH_LIBJPEG
+
+// 一个分量反量化后的系数，每块64个，自然顺序（行为垂直频率）
+struct JpegComponent
+{
+	int widthInBlocks;
+	int heightInBlocks;
+	vector<int> coeffs;
+};
+
+struct JpegCoefficients
+{
+	int channel;
+	int rows;
+	int cols;
+	vector<JpegComponent> components; // 按JPEG的顺序 Y Cb Cr
+};
+
+// libjpeg出错时默认直接退出进程，改成跳回调用处
+struct JpegError
+{
+	jpeg_error_mgr pub;
+	jmp_buf jump;
+};
+
+static void JpegErrorExit(j_common_ptr cinfo)
+{
+	longjmp(reinterpret_cast<JpegError*>(cinfo->err)->jump, 1);
+}
+
+static void JpegSilent(j_common_ptr cinfo) {}
+
+// 是否是可以直接转的格式：灰度，或 Y 2x2、Cb Cr 1x1 的YCbCr
+static bool Transcodable(const jpeg_decompress_struct& cinfo)
+{
+	if (cinfo.num_components == 1)
+		return cinfo.jpeg_color_space == JCS_GRAYSCALE;
+
+	return cinfo.num_components == 3 && cinfo.jpeg_color_space == JCS_YCbCr
+		&& cinfo.comp_info[0].h_samp_factor == 2 && cinfo.comp_info[0].v_samp_factor == 2
+		&& cinfo.comp_info[1].h_samp_factor == 1 && cinfo.comp_info[1].v_samp_factor == 1
+		&& cinfo.comp_info[2].h_samp_factor == 1 && cinfo.comp_info[2].v_samp_factor == 1;
+}
+
+// 读出系数并反量化；setjmp 之后不放有析构的局部对象，出错跳回时不会漏掉析构
+static bool ReadCoefficients(const char* data, size_t size, JpegCoefficients& out)
+{
+	jpeg_decompress_struct cinfo;
+	JpegError err;
+	cinfo.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = JpegErrorExit;
+	err.pub.output_message = JpegSilent;
+	if (setjmp(err.jump))
+	{
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, (unsigned char*)data, (unsigned long)size);
+	jpeg_read_header(&cinfo, TRUE);
+	if (!Transcodable(cinfo))
+	{
+		jpeg_destroy_decompress(&cinfo);
+		return false;
+	}
+
+	jvirt_barray_ptr* arrays = jpeg_read_coefficients(&cinfo);
+	out.channel = cinfo.num_components;
+	out.rows = cinfo.image_height;
+	out.cols = cinfo.image_width;
+	out.components.resize(cinfo.num_components);
+	for (int c = 0; c < cinfo.num_components; c++)
+	{
+		jpeg_component_info* comp = &cinfo.comp_info[c];
+		const UINT16* quant = comp->quant_table->quantval; // 自然顺序
+		JpegComponent& dst = out.components[c];
+		dst.widthInBlocks = comp->width_in_blocks;
+		dst.heightInBlocks = comp->height_in_blocks;
+		dst.coeffs.resize((size_t)dst.widthInBlocks * dst.heightInBlocks * DCTSIZE2);
+
+		int* p = dst.coeffs.data();
+		for (JDIMENSION by = 0; by < comp->height_in_blocks; by++)
+		{
+			JBLOCKARRAY row = cinfo.mem->access_virt_barray((j_common_ptr)&cinfo, arrays[c], by, 1, FALSE);
+			for (JDIMENSION bx = 0; bx < comp->width_in_blocks; bx++)
+				for (int k = 0; k < DCTSIZE2; k++)
+					*p++ = row[0][bx][k] * quant[k];
+		}
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	return true;
+}
+
+#endif
+
+bool JpegTranscoder::IsJpeg(const char* data, size_t size)
+{
+	return size >= 2 && (unsigned char)data[0] == 0xFF && (unsigned char)data[1] == 0xD8;
+}
+
+bool JpegTranscoder::TransformChannels(const char* data, size_t size, int& channel, int& rows, int& cols, vector<vector<int> >& orderData)
+{
+#ifndef IC_WITH_LIBJPEG
+	return false; // 没有libjpeg，全部按像素压缩
+#else
+	JpegCoefficients jpeg;
+	{
+		MemStage stage(STAGE_DCT);
+		if (!IsJpeg(data, size) || !ReadCoefficients(data, size, jpeg))
+			return false;
+	}
+
+	static const DCTTable<8> dct;
+	static constexpr ZigzagTable<8> zigzag = ZigzagTable<8>();
+
+	channel = jpeg.channel;
+	rows = jpeg.rows;
+	cols = jpeg.cols;
+	orderData.clear();
+	for (int i = 0; i < jpeg.channel; i++)
+	{
+		// 这里的通道顺序 Y Cr Cb
+		const JpegComponent& comp = jpeg.components[i == 0 ? 0 : 3 - i];
+
+		// 与 ImageCodec 的块数一致：色度是 rows/2 x cols/2 补齐到8
+		int pRow = i == 0 ? DCT::Padded(jpeg.rows) : DCT::Padded(jpeg.rows / 2);
+		int pCol = i == 0 ? DCT::Padded(jpeg.cols) : DCT::Padded(jpeg.cols / 2);
+
+		MemStage orderStage(STAGE_ORDER);
+		CountedVector<int> zigzagData((size_t)pRow * pCol, 0);
+		int* out = zigzagData.data();
+		for (int by = 0; by < pRow / 8; by++)
+		{
+			for (int bx = 0; bx < pCol / 8; bx++, out += 64)
+			{
+				if (by >= comp.heightInBlocks || bx >= comp.widthInBlocks)
+					continue; // JPEG的色度向上取整，块数不会更少，只是以防万一
+				const int* block = comp.coeffs.data() + ((size_t)by * comp.widthInBlocks + bx) * 64;
+				for (int k = 0; k < 64; k++)
+					if (dct.mask[k / 8][k % 8])
+						out[zigzag.pos[k]] = block[k];
+				out[0] += 1024; // 电平偏移
+			}
+		}
+		Stats::Add("jpeg blocks transcoded", pRow / 8 * (pCol / 8));
+
+		orderData.push_back(Order::RLE_Encode(zigzagData.data(), zigzagData.size()));
+	}
+
+	return true;
+#endif
+}
+
+vector<char> JpegTranscoder::Transcode(const char* data, size_t size, int tableId)
+{
+	vector<char> result;
+	int head[3];
+	vector<vector<int> > orderData;
+	if (!TransformChannels(data, size, head[0], head[1], head[2], orderData))
+		return result;
+
+	// 头，块大小为8，通道数的高16位为0
+	result.insert(result.end(), reinterpret_cast<char*>(head), reinterpret_cast<char*>(head) + 12);
+	for (size_t i = 0; i < orderData.size(); i++)
+		ImageCodec::AppendChannel(result, orderData[i], tableId);
+
+	return result;
+}
+
+// 读入整个JPEG文件，不是JPEG或读不出时返回false
+static bool ReadJpegFile(const string& path, vector<char>& data)
+{
+	ifstream infile(path, ios::binary | ios::in);
+	if (!infile.is_open())
+		return false;
+
+	char magic[2] = { 0, 0 };
+	infile.read(magic, 2);
+	if (!JpegTranscoder::IsJpeg(magic, 2))
+		return false;
+
+	// 目录等量不出大小的路径 tellg 为 -1 或极大值，交给调用方按像素读，由它报错
+	infile.seekg(0, ios::end);
+	streamoff length = infile.tellg();
+	if (length < 0 || length > 0x7fffffff)
+		return false;
+	data.resize((size_t)length);
+	infile.seekg(0, ios::beg);
+	infile.read(data.data(), data.size());
+
+	return !infile.fail();
+}
+
+vector<char> JpegTranscoder::TranscodeFile(const string& path, int tableId)
+{
+	vector<char> data;
+	if (!ReadJpegFile(path, data))
+		return vector<char>();
+
+	return Transcode(data.data(), data.size(), tableId);
+}
+
+bool JpegTranscoder::TransformFile(const string& path, vector<vector<int> >& orderData)
+{
+	vector<char> data;
+	int channel, rows, cols;
+
+	return ReadJpegFile(path, data) && TransformChannels(data.data(), data.size(), channel, rows, cols, orderData);
+}
@@ -0,0 +1,35 @@
+﻿/*
+	JPEG -> 压缩字节流，直接用JPEG里的DCT系数，不解码成像素
+
+	JPEG和这里用的是同一种8x8正交DCT，颜色转换也相同（JFIF的YCbCr），所以：
+	1、通过libjpeg的系数接口读出量化后的系数，乘量化表反量化
+	2、JPEG编码前像素减了128，DC差 128*8，加回1024
+	3、分量顺序 Y Cb Cr 对应这里的 Y Cr Cb
+	4、套用DCT里的量化表（去掉高频），再走 zigzag + RLE + Huffman
+
+	只支持灰度和4:2:0的彩色JPEG（与这里的色度下采样一致），其他情况返回空，由调用方按像素压缩
+	依赖 libjpeg-turbo（或 libjpeg 8 以上，需要 jpeg_mem_src），定义 IC_WITH_LIBJPEG 时才编译，
+	没有时 Transcode 总是返回空
+*/
+#pragma once
+#include "iostream"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class JpegTranscoder
+{
+public:
+	static bool IsJpeg(const char* data, size_t size); // 以SOI(FF D8)开头
+
+	// 结果与 ImageCodec::Encode 的格式相同（8x8块），不能直接转时返回空
+	static vector<char> Transcode(const char* data, size_t size, int tableId = -1);
+
+	static vector<char> TranscodeFile(const string& path, int tableId = -1);
+
+	// 只做到 zigzag + RLE，每个通道一份，即 Transcode 交给Huffman编码的数据（训练静态表用）
+	static bool TransformChannels(const char* data, size_t size, int& channel, int& rows, int& cols, vector<vector<int> >& orderData);
+
+	static bool TransformFile(const string& path, vector<vector<int> >& orderData);
+};
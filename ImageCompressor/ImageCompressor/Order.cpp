@@ -1,4 +1,4 @@
-// ZigzagУ8x8DCTϵӸƵƵ
+// ZigzagУNxNDCTϵӵƵƵ
 
 #include "opencv2/opencv.hpp"
 #include "opencv2/core/core.hpp"
@@ -9,41 +9,114 @@
 #include "Order.h"
 
 
+template<int N>
 vector<int> Order::ZigZag(Mat dct)
 {
-	vector<int> zigzagOrder(64);
-	for (int i = 0; i < 8; i++)
+	static constexpr ZigzagTable<N> zigzag = ZigzagTable<N>();
+	vector<int> zigzagOrder(N * N);
+	for (int i = 0; i < N; i++)
 	{
-		for (int j = 0; j < 8; j++)
-			zigzagOrder[zigzagTable[i * 8 + j]] = dct.at<int>(i, j);
+		const int* row = dct.ptr<int>(i);
+		for (int j = 0; j < N; j++)
+			zigzagOrder[zigzag.pos[i * N + j]] = row[j];
 	}
 
 	return zigzagOrder;
 }
 
+template<int N>
 Mat Order::iZigZag(vector<int> order)
 {
-	Mat reOrder(8, 8, CV_32SC1);
-	for (int i = 0; i < 8; i++)
+	static constexpr ZigzagTable<N> zigzag = ZigzagTable<N>();
+	Mat reOrder(N, N, CV_32SC1);
+	for (int i = 0; i < N; i++)
 	{
-		for (int j = 0; j < 8; j++)
-			reOrder.at<int>(i,j) = order[zigzagTable[i*8+j]];
+		int* row = reOrder.ptr<int>(i);
+		for (int j = 0; j < N; j++)
+			row[j] = order[zigzag.pos[i * N + j]];
 	}
 
 	return reOrder;
 }
 
+template vector<int> Order::ZigZag<4>(Mat);
+template vector<int> Order::ZigZag<8>(Mat);
+template vector<int> Order::ZigZag<16>(Mat);
+template Mat Order::iZigZag<4>(vector<int>);
+template Mat Order::iZigZag<8>(vector<int>);
+template Mat Order::iZigZag<16>(vector<int>);
+
 // RLE 
 vector<int> Order::RLE_Encode(const vector<int>& data) 
 {
-	vector<int> encoded_data;
+	return RLE_Encode(data.data(), data.size());
+}
+
+#if ORDER_SIMD
+// λ1λ
+static inline int LowestBit(uint64_t mask)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long idx;
+	_BitScanForward64(&idx, mask);
+	return (int)idx;
+#elif defined(_MSC_VER)
+	// 32λû _BitScanForward64
+	unsigned long idx;
+	if (_BitScanForward(&idx, (unsigned long)mask))
+		return (int)idx;
+	_BitScanForward(&idx, (unsigned long)(mask >> 32));
+	return (int)idx + 32;
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+// 64ϵһ飺Ƚ+movemaskõλͼȡλֵ
+vector<int> Order::RLE_Encode(const int* data, size_t size)
+{
+	vector<int> encoded_data(129);
+	size_t len = 0;
 	int zero_count = 0;
+	size_t i = 0;
+	const __m128i zero = _mm_setzero_si128();
 
-	for (int i = 0; i < data.size(); i++) 
+	for (; i + 64 <= size; i += 64)
+	{
+		uint64_t mask = 0; // kλΪ1ʾdata[i+k]
+		for (int k = 0; k < 16; k++)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + k * 4));
+			int zeros = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, zero)));
+			mask |= (uint64_t)(~zeros & 0xF) << (k * 4);
+		}
+
+		// һ128ǰ
+		if (encoded_data.size() < len + 129)
+			encoded_data.resize(encoded_data.size() * 2 > len + 129 ? encoded_data.size() * 2 : len + 129);
+		int* out = encoded_data.data() + len;
+
+		int cursor = 0; // һδλ
+		while (mask != 0)
+		{
+			int pos = LowestBit(mask);
+			mask &= mask - 1;
+			*out++ = zero_count + pos - cursor;
+			*out++ = data[i + pos];
+			zero_count = 0;
+			cursor = pos + 1;
+		}
+		zero_count += 64 - cursor;
+		len = out - encoded_data.data();
+	}
+	encoded_data.resize(len);
+
+	// 64β
+	for (; i < size; i++)
 	{
 		if (data[i] == 0)
 			zero_count++;
-		else 
+		else
 		{
 			encoded_data.push_back(zero_count);
 			encoded_data.push_back(data[i]);
@@ -52,41 +125,67 @@ vector<int> Order::RLE_Encode(const vector<int>& data)
 	}
 
 	// ĩβĸ
-	// ĴСΪ
 	encoded_data.push_back(zero_count);
 
 	return encoded_data;
 }
+#else
+vector<int> Order::RLE_Encode(const int* data, size_t size)
+{
+	return RLE_EncodeScalar(data, size);
+}
+#endif
 
-// RLE 
-vector<int> Order::RLE_Decode(const vector<int>& encoded_data) 
+// ɨİ汾
+vector<int> Order::RLE_EncodeScalar(const int* data, size_t size)
 {
-	vector<int> decoded_data;
+	vector<int> encoded_data;
 	int zero_count = 0;
 
-	for (int i = 0; i < encoded_data.size(); i++) 
+	for (int i = 0; i < size; i++) 
 	{
-		if (i % 2 == 0)
-			// ĸ
-			zero_count = encoded_data[i];
+		if (data[i] == 0)
+			zero_count++;
 		else 
 		{
-			// ֵ
-			int value = encoded_data[i];
-			while (zero_count > 0) 
-			{
-				decoded_data.push_back(0);
-				zero_count--;
-			}
-			decoded_data.push_back(value);
+			encoded_data.push_back(zero_count);
+			encoded_data.push_back(data[i]);
+			zero_count = 0;
 		}
 	}
 
-	// ĩβ0
-	while (zero_count-- > 0)
-		decoded_data.push_back(0);
+	// ĩβĸ
+	// ĴСΪ
+	encoded_data.push_back(zero_count);
 
-	return decoded_data;
+	return encoded_data;
 }
 
+// RLE 
+CountedVector<int> Order::RLE_Decode(const vector<int>& encoded_data) 
+{
+	// Ȱγ̼õĳ
+	size_t size = encoded_data.size() / 2;
+	for (size_t i = 0; i < encoded_data.size(); i += 2)
+		size += encoded_data[i];
+
+	return RLE_Decode(encoded_data, size);
+}
+
+// ֪󳤶ȣһηò㣬ֻдֵ
+CountedVector<int> Order::RLE_Decode(const vector<int>& encoded_data, size_t size)
+{
+	CountedVector<int> decoded_data(size, 0);
+	int* out = decoded_data.data();
+	size_t pos = 0;
 
+	for (size_t i = 0; i + 1 < encoded_data.size(); i += 2)
+	{
+		pos += encoded_data[i]; // 0
+		if (encoded_data[i] < 0 || pos >= size)
+			return CountedVector<int>(); // 볤Ȳ
+		out[pos++] = encoded_data[i + 1];
+	}
+
+	return decoded_data;
+}
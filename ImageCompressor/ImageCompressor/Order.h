@@ -6,30 +6,61 @@
 #include "iostream"
 #include <vector>
 
+#include "Stats.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define ORDER_SIMD 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define ORDER_SIMD 0
+#endif
+
 using namespace std;
 using namespace cv;
 
-static const uint8_t zigzagTable[64] =
+// zigzag˳pos[i*N+j] Ϊ(i, j)zigzagе±꣬
+// Խ i+j = d ߣdΪżʱiӴСʱС
+template<int N>
+struct ZigzagTable
 {
-	0,  1,  5,  6,  14, 15, 27, 28,
-    2,  4,  7,  13, 16, 26, 29, 42,
-	3,  8,  12, 17, 25, 30, 41, 43,
-	9,  11, 18, 24, 31, 40, 44, 53,
-    10, 19, 23, 32, 39, 45, 52, 54,
-	20, 22, 33, 38, 46, 51, 55, 60,
-	21, 34, 37, 47, 50, 56, 59, 61,
-	35, 36, 48, 49, 57, 58, 62, 63
+	int pos[N * N];
+
+	constexpr ZigzagTable() : pos()
+	{
+		int idx = 0;
+		for (int d = 0; d < 2 * N - 1; d++)
+		{
+			int lo = d < N ? 0 : d - N + 1;
+			int hi = d < N ? d : N - 1;
+			for (int k = 0; k <= hi - lo; k++)
+			{
+				int i = d % 2 == 0 ? hi - k : lo + k;
+				pos[i * N + d - i] = idx++;
+			}
+		}
+	}
 };
 
 class Order
 {
 public:
-	static vector<int> ZigZag(Mat dct); // һ
+	template<int N = 8>
+	static vector<int> ZigZag(Mat dct); // һNxN
 
-	static Mat iZigZag(vector<int> ); // һ
+	template<int N = 8>
+	static Mat iZigZag(vector<int> ); // һNxN
 
-	static vector<int> RLE_Decode(const vector<int>& encoded_data);
+	static CountedVector<int> RLE_Decode(const vector<int>& encoded_data);
+
+	static CountedVector<int> RLE_Decode(const vector<int>& encoded_data, size_t size); // ֪ĳ
 
 	static vector<int> RLE_Encode(const vector<int>& data);
+
+	static vector<int> RLE_Encode(const int* data, size_t size); // SSE2ʱ64һ
+
+	static vector<int> RLE_EncodeScalar(const int* data, size_t size); // ɨı룬ûSSE2ʱ RLE_Encode ֱ
 	
 };
\ No newline at end of file
@@ -0,0 +1,198 @@
+﻿#include "opencv2/opencv.hpp"
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "iostream"
+#include "fstream"
+#include <thread>
+
+#include "Pipeline.h"
+#include "ImageCodec.h"
+#include "JpegTranscoder.h"
+
+Pipeline::Pipeline(Mode mode, int workerNum, int maxInFlight)
+{
+	this->mode = mode;
+	this->workerNum = workerNum > 0 ? workerNum : (int)thread::hardware_concurrency();
+	if (this->workerNum <= 0)
+		this->workerNum = 1;
+	// 每个计算线程前后各留一份：一份在算，一份在读/写，双缓冲
+	this->maxInFlight = maxInFlight > 0 ? maxInFlight : this->workerNum * 2 + 2;
+	tableId = -1;
+	blockSize = 8;
+	archive = nullptr;
+	succeeded = 0;
+	readQueue = nullptr;
+	inFlight = 0;
+}
+
+int Pipeline::Run(const vector<pair<string, string> >& jobs)
+{
+	BoundedQueue<PipelineJob> queue(workerNum);
+	readQueue = &queue;
+	succeeded = 0;
+	inFlight = 0;
+	doneJobs.clear();
+
+	thread reader(&Pipeline::ReadStage, this, cref(jobs));
+	thread writer(&Pipeline::WriteStage, this, jobs.size());
+	vector<thread> workers;
+	for (int i = 0; i < workerNum; i++)
+		workers.push_back(thread(&Pipeline::ComputeStage, this));
+
+	reader.join();
+	for (int i = 0; i < workerNum; i++)
+		workers[i].join();
+	writer.join();
+	readQueue = nullptr;
+
+	return succeeded;
+}
+
+// 各种长度字段都是32位的，更大的文件不可能是合法输入
+static const streamoff MAX_INPUT_SIZE = 0x7fffffff;
+
+void Pipeline::ReadStage(const vector<pair<string, string> >& jobs)
+{
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		// 在途任务满了就等写线程释放
+		{
+			unique_lock<mutex> guard(flightLock);
+			flightFree.wait(guard, [this] { return inFlight < maxInFlight; });
+			inFlight++;
+		}
+
+		PipelineJob job;
+		job.seq = i;
+		job.srcPath = jobs[i].first;
+		job.dstPath = jobs[i].second;
+		job.ok = false;
+
+		// 目录等打得开但量不出大小的路径 tellg 会给 -1 或极大的值；分配失败也只算这一个文件失败
+		ifstream infile(job.srcPath, ios::binary | ios::in);
+		if (infile.is_open())
+		{
+			infile.seekg(0, ios::end);
+			streamoff length = infile.tellg();
+			if (length >= 0 && length <= MAX_INPUT_SIZE)
+			{
+				try
+				{
+					job.input.resize((size_t)length);
+					infile.seekg(0, ios::beg);
+					infile.read(job.input.data(), job.input.size());
+					job.ok = !infile.fail();
+				}
+				catch (const exception&)
+				{
+					vector<char>().swap(job.input);
+				}
+			}
+		}
+		if (!job.ok)
+			cout << "Can not open file: " << job.srcPath << endl;
+
+		readQueue->Push(std::move(job));
+	}
+	readQueue->Close();
+}
+
+void Pipeline::ComputeStage()
+{
+	PipelineJob job;
+	while (readQueue->Pop(job))
+	{
+		// 单个文件出错（损坏的头、内存不够等）只算这一个失败，结果照样交给写线程，否则按序写出会一直等它
+		if (job.ok)
+		{
+			try
+			{
+				Process(job);
+			}
+			catch (const exception& e)
+			{
+				cout << "Failed to process " << job.srcPath << ": " << e.what() << endl;
+				job.ok = false;
+				vector<char>().swap(job.input);
+				vector<char>().swap(job.output);
+			}
+		}
+
+		lock_guard<mutex> guard(doneLock);
+		size_t seq = job.seq;
+		doneJobs[seq] = std::move(job);
+		doneReady.notify_all();
+	}
+}
+
+void Pipeline::Process(PipelineJob& job)
+{
+	if (mode == COMPRESS && blockSize == 8 && JpegTranscoder::IsJpeg(job.input.data(), job.input.size())
+		&& !(job.output = JpegTranscoder::Transcode(job.input.data(), job.input.size(), tableId)).empty())
+	{
+		// JPEG直接转系数，成功就不用解码成像素
+	}
+	else if (mode == COMPRESS)
+	{
+		Mat src = imdecode(Mat(1, (int)job.input.size(), CV_8UC1, job.input.data()), IMREAD_UNCHANGED);
+		if (!src.data)
+		{
+			cout << "Can not decode image: " << job.srcPath << endl;
+			job.ok = false;
+			return;
+		}
+		job.output = ImageCodec::Encode(src, tableId, blockSize);
+	}
+	else
+	{
+		// 计算线程已经按核数开了，单个文件内不再并行解码
+		Mat dst = ImageCodec::Decode(job.input.data(), job.input.size(), 1);
+		vector<uchar> buf;
+		size_t dot = job.dstPath.find_last_of('.');
+		string ext = dot == string::npos ? ".png" : job.dstPath.substr(dot);
+		if (dst.empty() || !imencode(ext, dst, buf))
+		{
+			cout << "Invalid file: " << job.srcPath << endl;
+			job.ok = false;
+			return;
+		}
+		job.output.assign(buf.begin(), buf.end());
+	}
+
+	// 输入已经用不到了，提前释放
+	vector<char>().swap(job.input);
+}
+
+void Pipeline::WriteStage(size_t total)
+{
+	for (size_t seq = 0; seq < total; seq++)
+	{
+		PipelineJob job;
+		{
+			unique_lock<mutex> guard(doneLock);
+			doneReady.wait(guard, [this, seq] { return doneJobs.count(seq) > 0; });
+			job = std::move(doneJobs[seq]);
+			doneJobs.erase(seq);
+		}
+
+		if (job.ok)
+		{
+			if (archive != nullptr)
+				job.ok = archive->Append(job.dstPath, job.output);
+			else
+			{
+				ofstream outfile(job.dstPath, ios::binary | ios::out);
+				outfile.write(job.output.data(), job.output.size());
+				job.ok = !outfile.fail();
+			}
+			if (job.ok)
+				succeeded++;
+			else
+				cout << "Can not write: " << job.dstPath << endl;
+		}
+
+		lock_guard<mutex> guard(flightLock);
+		inFlight--;
+		flightFree.notify_one();
+	}
+}
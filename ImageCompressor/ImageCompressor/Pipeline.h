@@ -0,0 +1,124 @@
+﻿/*
+	批量压缩/解压的流水线：读文件 -> 计算 -> 写文件 三段并行
+
+	1、读线程按顺序预读输入文件（只做I/O，图片解码放到计算线程）
+	2、多个计算线程执行压缩/解压
+	3、写线程按输入顺序写出结果（文件或归档）
+
+	同时在流水线里的任务数有上限，读得再快也不会把内存撑满
+*/
+#pragma once
+#include "opencv2/opencv.hpp"
+#include "opencv2/core/core.hpp"
+#include "iostream"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+
+#include "Archive.h"
+
+using namespace cv;
+using namespace std;
+
+// 有界队列，满了Push阻塞，空了Pop阻塞，Close后Pop取完剩余的返回false
+template<typename T>
+class BoundedQueue
+{
+public:
+	BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+	void Push(T item)
+	{
+		unique_lock<mutex> guard(lock);
+		notFull.wait(guard, [this] { return items.size() < capacity; });
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+	}
+
+	bool Pop(T& item)
+	{
+		unique_lock<mutex> guard(lock);
+		notEmpty.wait(guard, [this] { return !items.empty() || closed; });
+		if (items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	void Close()
+	{
+		lock_guard<mutex> guard(lock);
+		closed = true;
+		notEmpty.notify_all();
+	}
+
+private:
+	size_t capacity;
+	bool closed;
+	deque<T> items;
+	mutex lock;
+	condition_variable notFull;
+	condition_variable notEmpty;
+};
+
+struct PipelineJob
+{
+	size_t seq; // 输入顺序，写线程按它排序
+	string srcPath;
+	string dstPath; // 写归档时作为条目名
+	vector<char> input;
+	vector<char> output;
+	bool ok;
+};
+
+class Pipeline
+{
+public:
+	enum Mode { COMPRESS, DECOMPRESS };
+
+	// workerNum <= 0 时按CPU核数；maxInFlight 为同时在流水线中的任务上限
+	Pipeline(Mode mode, int workerNum = 0, int maxInFlight = 0);
+
+	void SetTable(int id) { tableId = id; } // 压缩用的Huffman表
+
+	void SetBlockSize(int size) { blockSize = size; } // 压缩用的块大小
+
+	void SetArchive(ArchiveWriter* writer) { archive = writer; } // 设置后压缩结果写进归档
+
+	// jobs: (输入路径, 输出路径/条目名)，返回成功的个数
+	int Run(const vector<pair<string, string> >& jobs);
+
+private:
+	void ReadStage(const vector<pair<string, string> >& jobs);
+
+	void ComputeStage();
+
+	void WriteStage(size_t total);
+
+	void Process(PipelineJob& job);
+
+	Mode mode;
+	int workerNum;
+	int maxInFlight;
+	int tableId;
+	int blockSize;
+	ArchiveWriter* archive;
+	int succeeded;
+
+	BoundedQueue<PipelineJob>* readQueue; // 读 -> 计算
+
+	// 计算 -> 写，按seq重排
+	map<size_t, PipelineJob> doneJobs;
+	mutex doneLock;
+	condition_variable doneReady;
+
+	// 在途任务数，读线程占位、写线程释放
+	int inFlight;
+	mutex flightLock;
+	condition_variable flightFree;
+};
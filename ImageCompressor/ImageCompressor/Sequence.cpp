@@ -0,0 +1,480 @@
+﻿#include "opencv2/opencv.hpp"
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "iostream"
+#include "fstream"
+#include "math.h"
+#include <string.h>
+
+#include "Sequence.h"
+#include "ImageCodec.h"
+#include "DCT.h"
+#include "Order.h"
+#include "Stats.h"
+
+static const char SEQUENCE_MAGIC[4] = { 'I', 'C', 'S', 'Q' };
+static const size_t HEADER_SIZE = 16; // 魔数(4) | 通道数(4) | rows(4) | cols(4)
+static const size_t FOOTER_SIZE = 16; // 索引偏移(8) | 帧数(4) | 魔数(4)
+
+const uint32_t SequenceWriter::PREVIOUS_TABLE;
+
+static void Put(vector<char>& out, const void* value, size_t bytes)
+{
+	const char* p = reinterpret_cast<const char*>(value);
+	out.insert(out.end(), p, p + bytes);
+}
+
+// 两个8x8 uchar块的差的绝对值之和
+static int BlockSAD(const uchar* a, size_t stepA, const uchar* b, size_t stepB)
+{
+#if DCT_SIMD
+	__m128i acc = _mm_setzero_si128();
+	for (int r = 0; r < 8; r++)
+	{
+		__m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + r * stepA));
+		__m128i y = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + r * stepB));
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(x, y));
+	}
+	return _mm_cvtsi128_si32(acc);
+#else
+	int sad = 0;
+	for (int r = 0; r < 8; r++)
+		for (int c = 0; c < 8; c++)
+			sad += abs(a[r * stepA + c] - b[r * stepB + c]);
+	return sad;
+#endif
+}
+
+SequenceWriter::SequenceWriter(int keyInterval, int sadThreshold)
+{
+	this->keyInterval = keyInterval > 0 ? keyInterval : 1;
+	this->sadThreshold = sadThreshold;
+	dataEnd = 0;
+	channel = rows = cols = 0;
+}
+
+bool SequenceWriter::Open(const string& path)
+{
+	Close();
+	frames.clear();
+	reference.clear();
+	weights.clear();
+	tables.clear();
+	channel = rows = cols = 0;
+	dataEnd = 0;
+
+	file.open(path, ios::binary | ios::out);
+	return file.is_open();
+}
+
+bool SequenceWriter::Append(Mat frame, int tableId)
+{
+	if (!file.is_open() || frame.empty())
+		return false;
+
+	if (frames.empty())
+	{
+		// 第一帧决定整个序列的大小，写头
+		if (frame.channels() != 1 && frame.channels() != 3)
+			return false;
+		channel = frame.channels();
+		rows = frame.rows;
+		cols = frame.cols;
+		reference.assign(channel, Mat());
+		weights.assign(channel, unordered_map<int, uint32_t>());
+		tables.assign(channel, shared_ptr<HuffmanCode>());
+
+		vector<char> head(SEQUENCE_MAGIC, SEQUENCE_MAGIC + 4);
+		Put(head, &channel, 4);
+		Put(head, &rows, 4);
+		Put(head, &cols, 4);
+		file.write(head.data(), head.size());
+		dataEnd = HEADER_SIZE;
+	}
+	else if (frame.channels() != channel || frame.rows != rows || frame.cols != cols)
+		return false;
+
+	// 分通道并填充到8的整数倍，和DCTNxN里的填充一致
+	vector<Mat> channels = ImageCodec::SplitChannels(frame);
+	for (int i = 0; i < channel; i++)
+		copyMakeBorder(channels[i], channels[i], 0, DCT::Padded(channels[i].rows) - channels[i].rows,
+			0, DCT::Padded(channels[i].cols) - channels[i].cols, BORDER_CONSTANT, Scalar(0));
+
+	bool key = frames.size() % keyInterval == 0;
+	vector<char> data = EncodeFrame(channels, key, tableId);
+
+	file.write(data.data(), data.size());
+	if (!file)
+		return false;
+
+	FrameEntry e;
+	e.offset = dataEnd;
+	e.size = data.size();
+	e.type = key ? FRAME_KEY : FRAME_INTER;
+	frames.push_back(e);
+	dataEnd += data.size();
+
+	return true;
+}
+
+vector<char> SequenceWriter::EncodeFrame(const vector<Mat>& channels, bool key, int tableId)
+{
+	vector<char> result;
+	int type = key ? FRAME_KEY : FRAME_INTER;
+	Put(result, &type, 4);
+
+	// 关键帧不依赖之前的表
+	if (key)
+	{
+		weights.assign(channel, unordered_map<int, uint32_t>());
+		tables.assign(channel, shared_ptr<HuffmanCode>());
+	}
+
+	for (int c = 0; c < channel; c++)
+	{
+		const Mat& img = channels[c];
+		int blocksX = img.cols / 8;
+		int blocks = img.rows / 8 * blocksX;
+		vector<char> bitmap((blocks + 7) / 8, 0); // 第k位为1表示第k块不变
+		int skipped = 0;
+		DCT quantizer;
+
+		// 只对变化的块做DCT + zigzag
+		CountedVector<int> orderData;
+		{
+			MemStage dctStage(STAGE_DCT);
+			if (key)
+			{
+				reference[c] = img.clone();
+				Mat dctImg = quantizer.DCTNxN(img);
+				for (int y = 0; y < dctImg.rows; y += 8)
+				{
+					for (int x = 0; x < dctImg.cols; x += 8)
+					{
+						vector<int> tmp = Order::ZigZag(dctImg(Rect(x, y, 8, 8)));
+						orderData.insert(orderData.end(), tmp.begin(), tmp.end());
+					}
+				}
+			}
+			else
+			{
+				for (int k = 0; k < blocks; k++)
+				{
+					int x = k % blocksX * 8, y = k / blocksX * 8;
+					if (BlockSAD(img.ptr<uchar>(y) + x, img.step, reference[c].ptr<uchar>(y) + x, reference[c].step) <= sadThreshold)
+					{
+						bitmap[k >> 3] |= 1 << (k & 7);
+						skipped++;
+						continue;
+					}
+
+					img(Rect(x, y, 8, 8)).copyTo(reference[c](Rect(x, y, 8, 8)));
+					size_t n = orderData.size();
+					orderData.resize(n + 64);
+					quantizer.DCTBlock(img.ptr<uchar>(y) + x, img.step, orderData.data() + n); // 逐块变换，不分配Mat
+				}
+				result.insert(result.end(), bitmap.begin(), bitmap.end());
+			}
+		}
+		Stats::Add("sequence blocks", blocks);
+		Stats::Add("sequence blocks skipped", skipped);
+
+		// 没有变化的块，通道大小为0
+		vector<char> bitSeq;
+		if (!orderData.empty())
+		{
+			MemStage orderStage(STAGE_ORDER);
+			vector<int> rleData = Order::RLE_Encode(orderData.data(), orderData.size());
+			bitSeq = EncodeCoefficients(c, rleData, key, tableId);
+		}
+
+		int curSize = bitSeq.size();
+		Put(result, &curSize, 4);
+		result.insert(result.end(), bitSeq.begin(), bitSeq.end());
+	}
+
+	return result;
+}
+
+vector<char> SequenceWriter::EncodeCoefficients(int c, const vector<int>& data, bool key, int tableId)
+{
+	MemStage stage(STAGE_HUFFMAN_ENC);
+	HuffmanCode encoder;
+	if (tableId >= 0)
+		return encoder.Encode(data, (uint32_t)tableId);
+
+	if (!key && !weights[c].empty())
+	{
+		// 沿用前一张表的码长（表外的值按ESCAPE算） vs 新表：按熵估算码长 + 频率表
+		unordered_map<int, uint32_t> histogram;
+		for (size_t i = 0; i < data.size(); i++)
+			histogram[data[i]]++;
+
+		if (!tables[c])
+			tables[c] = HuffmanCode::MakeTable(weights[c]);
+		uint64_t reuseBits = tables[c]->CodeLength(histogram);
+		double newBits = (4 + 8.0 * histogram.size()) * 8;
+		for (auto i : histogram)
+			newBits -= i.second * log2((double)i.second / data.size());
+
+		if (reuseBits <= newBits)
+		{
+			Stats::Add("huffman tables reused");
+			return encoder.Encode(data, *tables[c], PREVIOUS_TABLE);
+		}
+	}
+
+	vector<char> bitSeq = encoder.Encode(data);
+	weights[c] = encoder.GetWeightTable();
+	tables[c].reset();
+
+	return bitSeq;
+}
+
+bool SequenceWriter::Close()
+{
+	if (!file.is_open())
+		return true;
+
+	vector<char> tail;
+	if (frames.empty()) // 没有帧也写一个合法的头
+	{
+		tail.assign(SEQUENCE_MAGIC, SEQUENCE_MAGIC + 4);
+		tail.resize(HEADER_SIZE, 0);
+		dataEnd = HEADER_SIZE;
+	}
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		Put(tail, &frames[i].offset, 8);
+		Put(tail, &frames[i].size, 4);
+		Put(tail, &frames[i].type, 4);
+	}
+
+	uint64_t indexOffset = dataEnd;
+	uint32_t count = frames.size();
+	Put(tail, &indexOffset, 8);
+	Put(tail, &count, 4);
+	tail.insert(tail.end(), SEQUENCE_MAGIC, SEQUENCE_MAGIC + 4);
+
+	file.write(tail.data(), tail.size());
+	bool ok = !file.fail();
+	file.close();
+
+	return ok;
+}
+
+bool SequenceReader::Open(const string& path)
+{
+	file.close();
+	file.clear();
+	frames.clear();
+	current = -1;
+
+	file.open(path, ios::binary | ios::in);
+	if (!file.is_open())
+		return false;
+
+	file.seekg(0, ios::end);
+	uint64_t fileSize = file.tellg();
+	if (fileSize < HEADER_SIZE + FOOTER_SIZE)
+		return false;
+
+	char head[HEADER_SIZE], footer[FOOTER_SIZE];
+	file.seekg(0);
+	file.read(head, HEADER_SIZE);
+	file.seekg(fileSize - FOOTER_SIZE);
+	file.read(footer, FOOTER_SIZE);
+	if (!file || memcmp(head, SEQUENCE_MAGIC, 4) != 0 || memcmp(footer + 12, SEQUENCE_MAGIC, 4) != 0)
+		return false;
+	memcpy(&channel, head + 4, 4);
+	memcpy(&rows, head + 8, 4);
+	memcpy(&cols, head + 12, 4);
+
+	uint64_t indexOffset;
+	uint32_t count;
+	memcpy(&indexOffset, footer, 8);
+	memcpy(&count, footer + 8, 4);
+	if (indexOffset < HEADER_SIZE || indexOffset + (uint64_t)count * 16 != fileSize - FOOTER_SIZE)
+		return false;
+	if (count > 0 && ((channel != 1 && channel != 3) || rows <= 0 || cols <= 0))
+		return false;
+
+	vector<char> index(count * 16);
+	file.seekg(indexOffset);
+	file.read(index.data(), index.size());
+	if (!file)
+		return false;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		FrameEntry e;
+		memcpy(&e.offset, index.data() + i * 16, 8);
+		memcpy(&e.size, index.data() + i * 16 + 8, 4);
+		memcpy(&e.type, index.data() + i * 16 + 12, 4);
+		if (e.offset + e.size > indexOffset || (i == 0 && e.type != FRAME_KEY))
+		{
+			frames.clear();
+			return false;
+		}
+		frames.push_back(e);
+	}
+
+	reconstructed.assign(channel, Mat());
+	weights.assign(channel, unordered_map<int, uint32_t>());
+	tables.assign(channel, shared_ptr<HuffmanCode>());
+	return true;
+}
+
+Mat SequenceReader::Load(int index)
+{
+	if (index < 0 || index >= (int)frames.size())
+		return Mat();
+
+	// 从前一个关键帧开始；已经解到这个关键帧之后、index之前时接着解
+	int start = index;
+	while (start > 0 && frames[start].type != FRAME_KEY)
+		start--;
+	if (current >= start && current <= index)
+		start = current + 1;
+
+	for (int i = start; i <= index; i++)
+	{
+		if (!DecodeFrame(i))
+		{
+			current = -1;
+			return Mat();
+		}
+	}
+
+	Mat image = ImageCodec::MergeChannels(reconstructed, rows, cols);
+	return channel == 1 ? image.clone() : image; // 灰度图是 reconstructed 的一部分，下一帧会改写
+}
+
+bool SequenceReader::DecodeFrame(int index)
+{
+	const FrameEntry& e = frames[index];
+	vector<char> data(e.size);
+	file.clear();
+	file.seekg(e.offset);
+	file.read(data.data(), data.size());
+	if (!file || data.size() < 4)
+		return false;
+
+	int type;
+	memcpy(&type, data.data(), 4);
+	bool key = type == FRAME_KEY;
+	if (key)
+	{
+		weights.assign(channel, unordered_map<int, uint32_t>());
+		tables.assign(channel, shared_ptr<HuffmanCode>());
+	}
+	else if (current != index - 1)
+		return false;
+
+	size_t fp = 4;
+	for (int c = 0; c < channel; c++)
+	{
+		int pRow = c == 0 ? DCT::Padded(rows) : DCT::Padded(rows / 2);
+		int pCol = c == 0 ? DCT::Padded(cols) : DCT::Padded(cols / 2);
+		int blocks = pRow / 8 * (pCol / 8);
+
+		const char* bitmap = nullptr;
+		if (!key)
+		{
+			if (fp + (blocks + 7) / 8 > data.size())
+				return false;
+			bitmap = data.data() + fp;
+			fp += (blocks + 7) / 8;
+		}
+
+		int cSize;
+		if (fp + 4 > data.size())
+			return false;
+		memcpy(&cSize, data.data() + fp, 4);
+		fp += 4;
+		if (cSize < 0 || fp + cSize > data.size())
+			return false;
+
+		if (!DecodeChannel(c, bitmap, data.data() + fp, cSize, pRow, pCol))
+			return false;
+		fp += cSize;
+	}
+
+	current = index;
+	return true;
+}
+
+bool SequenceReader::DecodeChannel(int c, const char* bitmap, const char* data, size_t size, int pRow, int pCol)
+{
+	int blocksX = pCol / 8;
+	int blocks = pRow / 8 * blocksX;
+
+	// 码流里有的块
+	vector<int> coded;
+	for (int k = 0; k < blocks; k++)
+		if (bitmap == nullptr || ((bitmap[k >> 3] >> (k & 7)) & 1) == 0)
+			coded.push_back(k);
+	if (bitmap != nullptr && reconstructed[c].empty())
+		return false;
+	if (coded.empty())
+		return size == 0;
+	if (size < 8)
+		return false;
+
+	// Huffman解码，沿用前一张表的码流头部是 PREVIOUS_TABLE
+	MemStage huffmanStage(STAGE_HUFFMAN_DEC);
+	vector<char> stream(data, data + size);
+	uint32_t head;
+	memcpy(&head, data, 4);
+	HuffmanCode decoder;
+	vector<int> decodeData;
+	if (head == (HuffmanCode::STATIC_FLAG | SequenceWriter::PREVIOUS_TABLE))
+	{
+		if (weights[c].empty())
+			return false;
+		if (!tables[c])
+			tables[c] = HuffmanCode::MakeTable(weights[c]);
+		decodeData = decoder.DecodeStatic(stream, *tables[c]);
+	}
+	else
+	{
+		decodeData = decoder.DecodeParallel(stream);
+		if (!(head & HuffmanCode::STATIC_FLAG))
+		{
+			weights[c] = decoder.GetWeightTable();
+			tables[c].reset();
+		}
+	}
+	if (decodeData.empty())
+		return false;
+
+	// RLE解码 + izigzag
+	MemStage orderStage(STAGE_IORDER);
+	CountedVector<int> reorderData = Order::RLE_Decode(decodeData, coded.size() * 64);
+	if (reorderData.empty())
+		return false;
+
+	MemStage idctStage(STAGE_IDCT);
+	DCT quantizer;
+	if (bitmap == nullptr)
+	{
+		// 关键帧和单张图片一样整幅做iDCT
+		Mat reMat = Mat::zeros(pRow, pCol, CV_32SC1);
+		for (int k = 0; k < blocks; k++)
+		{
+			vector<int> tmpV(reorderData.begin() + k * 64, reorderData.begin() + k * 64 + 64);
+			Order::iZigZag(tmpV).copyTo(reMat(Rect(k % blocksX * 8, k / blocksX * 8, 8, 8)));
+		}
+		reconstructed[c] = quantizer.iDCTNxN(reMat);
+		return true;
+	}
+
+	// 只改写变化的块，其余保持上一帧
+	for (size_t n = 0; n < coded.size(); n++)
+	{
+		int k = coded[n];
+		int x = k % blocksX * 8, y = k / blocksX * 8;
+		quantizer.iDCTBlock(reorderData.data() + n * 64, reconstructed[c].ptr<uchar>(y) + x, reconstructed[c].step);
+	}
+
+	return true;
+}
@@ -0,0 +1,105 @@
+﻿/*
+	图像序列（延时摄影、录屏）：相邻帧大部分相同，只编码变化的8x8块
+
+	1、每隔 keyInterval 帧一个关键帧，关键帧和单张图片一样编码所有块，不依赖前面的帧
+	2、其余帧用SAD和参考块比较，差别不超过阈值的块只在位图里标记为不变，不做DCT也不占码流
+	   参考块是该位置上一次实际编码的原图块，所以连续的微小变化累积起来也会被编码
+	3、变化块的系数和前一次建的Huffman表比较估算码长，够好就直接用前一张表，不写频率表
+	4、尾部有每帧的索引，随机读取时从前一个关键帧开始解
+
+	<文件格式>
+	"ICSQ" | 通道数 | rows | cols | 帧1 | 帧2 | ... | 索引 | 索引偏移(8) | 帧数(4) | "ICSQ"
+	帧：类型(4) | 通道1 | 通道2 | ...
+	通道：[不变块位图，仅非关键帧] | 大小(4) | Huffman码流（无变化块时大小为0）
+	码流头部为 STATIC_FLAG|PREVIOUS_TABLE 时用的是前一张表
+	索引条目：偏移(8) | 大小(4) | 类型(4)
+*/
+#pragma once
+#include "opencv2/opencv.hpp"
+#include "opencv2/core/core.hpp"
+#include "iostream"
+#include "fstream"
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "HuffmanCode.h"
+
+using namespace cv;
+using namespace std;
+
+enum FrameType
+{
+	FRAME_KEY,
+	FRAME_INTER
+};
+
+struct FrameEntry
+{
+	uint64_t offset;
+	uint32_t size;
+	int type;
+};
+
+class SequenceWriter
+{
+public:
+	static const uint32_t PREVIOUS_TABLE = 0x7fffffff; // 码流头部里表示沿用前一张表的ID
+
+	// sadThreshold 为8x8块内像素差绝对值之和的上限，0 表示只跳过完全相同的块
+	SequenceWriter(int keyInterval = 30, int sadThreshold = 64);
+
+	~SequenceWriter() { Close(); }
+
+	bool Open(const string& path);
+
+	// 所有帧大小、通道数必须与第一帧相同；tableId >= 0 时全部用该静态表，不再沿用前一张表
+	bool Append(Mat frame, int tableId = -1);
+
+	bool Close(); // 写索引和尾部
+
+private:
+	vector<char> EncodeFrame(const vector<Mat>& channels, bool key, int tableId);
+
+	vector<char> EncodeCoefficients(int c, const vector<int>& data, bool key, int tableId); // Huffman，按估算的码长决定是否沿用前一张表
+
+	int keyInterval;
+	int sadThreshold;
+	ofstream file;
+	uint64_t dataEnd;
+	int channel, rows, cols;
+	vector<FrameEntry> frames;
+	vector<Mat> reference; // 每个通道（已填充），每块为上一次编码时的原图
+	vector<unordered_map<int, uint32_t> > weights; // 每个通道最近一次新建的表的频率
+	vector<shared_ptr<HuffmanCode> > tables; // 由 weights 建好的表，第一次沿用时才建
+};
+
+class SequenceReader
+{
+public:
+	SequenceReader() : channel(0), rows(0), cols(0), current(-1) {}
+
+	bool Open(const string& path);
+
+	int FrameCount() const { return frames.size(); }
+
+	const vector<FrameEntry>& Frames() const { return frames; }
+
+	// 解第index帧；顺序读取时接着上一帧解，否则从前一个关键帧开始，失败返回空Mat
+	Mat Load(int index);
+
+private:
+	bool DecodeFrame(int index);
+
+	// bitmap 为空表示关键帧，所有块都在码流里
+	bool DecodeChannel(int c, const char* bitmap, const char* data, size_t size, int pRow, int pCol);
+
+	ifstream file;
+	int channel, rows, cols;
+	vector<FrameEntry> frames;
+	vector<Mat> reconstructed; // 每个通道（已填充）当前帧的解码结果
+	vector<unordered_map<int, uint32_t> > weights;
+	vector<shared_ptr<HuffmanCode> > tables;
+	int current; // reconstructed 对应的帧号
+};
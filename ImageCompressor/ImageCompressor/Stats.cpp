@@ -0,0 +1,144 @@
+﻿#include "opencv2/opencv.hpp"
+#include "opencv2/core/core.hpp"
+#include "iostream"
+#include <iomanip>
+
+#include "Stats.h"
+
+using namespace cv;
+
+static const char* STAGE_NAMES[STAGE_COUNT] =
+{
+	"other", "split", "dct", "zigzag+rle", "huffman encode",
+	"huffman decode", "rle decode+izigzag", "idct", "merge"
+};
+
+atomic<bool> Stats::enabled(false);
+thread_local int Stats::currentStage = STAGE_OTHER;
+Stats::StageMemory Stats::stages[STAGE_COUNT];
+atomic<int64_t> Stats::totalLive(0);
+atomic<int64_t> Stats::totalPeak(0);
+mutex Stats::counterLock;
+map<string, int64_t> Stats::counters;
+
+// Mat 的计数分配器：实际分配交给OpenCV默认的分配器，只记录大小和所在阶段
+class CountingMatAllocator : public MatAllocator
+{
+public:
+	UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag flags, UMatUsageFlags usageFlags) const
+	{
+		UMatData* u = Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+		if (u == nullptr)
+			return u;
+		u->prevAllocator = u->currAllocator = this; // 释放时回到这里
+		if (data == nullptr) // 外部数据不算
+		{
+			int stage = Stats::CurrentStage();
+			lock_guard<mutex> guard(lock);
+			owners[u] = make_pair(stage, (int64_t)u->size);
+			Stats::RecordMemory(stage, u->size);
+		}
+		return u;
+	}
+
+	bool allocate(UMatData* u, AccessFlag accessFlags, UMatUsageFlags usageFlags) const
+	{
+		return Mat::getStdAllocator()->allocate(u, accessFlags, usageFlags);
+	}
+
+	void deallocate(UMatData* u) const
+	{
+		if (u == nullptr)
+			return;
+		{
+			lock_guard<mutex> guard(lock);
+			map<UMatData*, pair<int, int64_t> >::iterator it = owners.find(u);
+			if (it != owners.end())
+			{
+				Stats::RecordMemory(it->second.first, -it->second.second);
+				owners.erase(it);
+			}
+		}
+		u->prevAllocator = u->currAllocator = Mat::getStdAllocator();
+		Mat::getStdAllocator()->deallocate(u);
+	}
+
+private:
+	mutable mutex lock;
+	mutable map<UMatData*, pair<int, int64_t> > owners; // 分配时的阶段和大小
+};
+
+// 关闭统计后已分配的Mat仍会回到这里释放，全局对象（如解压缓存）里的Mat可能到静态析构时才释放，
+// 所以放在堆上且永不释放，不参与静态析构
+static CountingMatAllocator& CountingAllocatorInstance()
+{
+	static CountingMatAllocator& allocator = *new CountingMatAllocator();
+	return allocator;
+}
+
+void Stats::Enable(bool on)
+{
+	enabled = on;
+	Mat::setDefaultAllocator(on ? &CountingAllocatorInstance() : Mat::getStdAllocator());
+	Reset();
+}
+
+void Stats::Add(const string& counter, int64_t value)
+{
+	if (!enabled)
+		return;
+	lock_guard<mutex> guard(counterLock);
+	counters[counter] += value;
+}
+
+void Stats::RecordMemory(int stage, int64_t bytes)
+{
+	StageMemory& s = stages[stage];
+	if (bytes > 0)
+		s.allocated += bytes;
+
+	int64_t live = s.live += bytes;
+	int64_t peak = s.peak;
+	while (live > peak && !s.peak.compare_exchange_weak(peak, live));
+
+	live = totalLive += bytes;
+	peak = totalPeak;
+	while (live > peak && !totalPeak.compare_exchange_weak(peak, live));
+}
+
+void Stats::Reset()
+{
+	{
+		lock_guard<mutex> guard(counterLock);
+		counters.clear();
+	}
+	for (int i = 0; i < STAGE_COUNT; i++)
+	{
+		stages[i].allocated = 0;
+		stages[i].peak = stages[i].live.load();
+	}
+	totalPeak = totalLive.load();
+}
+
+void Stats::Print()
+{
+	if (!enabled)
+		return;
+
+	cout << "\n<Statistics>" << endl;
+	{
+		lock_guard<mutex> guard(counterLock);
+		for (auto i : counters)
+			cout << "  " << left << setw(24) << i.first << right << i.second << endl;
+	}
+
+	cout << "  " << left << setw(24) << "stage" << right << setw(14) << "allocated" << setw(14) << "live" << setw(14) << "peak" << endl;
+	for (int i = 0; i < STAGE_COUNT; i++)
+	{
+		if (stages[i].allocated == 0 && stages[i].peak == 0)
+			continue;
+		cout << "  " << left << setw(24) << STAGE_NAMES[i] << right
+			<< setw(14) << stages[i].allocated << setw(14) << stages[i].live << setw(14) << stages[i].peak << endl;
+	}
+	cout << "  " << left << setw(24) << "total" << right << setw(14) << "" << setw(14) << totalLive << setw(14) << totalPeak << endl;
+}
@@ -0,0 +1,117 @@
+﻿/*
+	统计：计数器 + 各阶段内存占用
+
+	计数器按名字累加，压缩/解压完成后随统计一起输出
+	内存按阶段记录 分配总量 / 当前占用 / 峰值：
+	1、Mat 通过 CountingMatAllocator 计入（Enable 时设为默认分配器）
+	2、大的 vector 缓冲区用 CountedVector，分配时计入当前线程所在的阶段
+	阶段用 MemStage 划分，析构时回到上一个阶段
+*/
+#pragma once
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <atomic>
+#include <mutex>
+
+using namespace std;
+
+enum MemStageId
+{
+	STAGE_OTHER,
+	STAGE_SPLIT,       // 颜色转换、下采样
+	STAGE_DCT,         // DCT + 量化
+	STAGE_ORDER,       // zigzag + RLE
+	STAGE_HUFFMAN_ENC, // Huffman编码
+	STAGE_HUFFMAN_DEC, // Huffman解码
+	STAGE_IORDER,      // RLE解码 + izigzag
+	STAGE_IDCT,        // iDCT
+	STAGE_MERGE,       // 上采样、合并通道、颜色转换
+	STAGE_COUNT
+};
+
+class Stats
+{
+public:
+	static bool Enabled() { return enabled; }
+
+	static void Enable(bool on); // 开启时同时把 Mat 的默认分配器换成计数的
+
+	static void Add(const string& counter, int64_t value = 1); // 未开启时忽略
+
+	static void Reset(); // 清零计数器和累计量，峰值从当前占用重新算
+
+	static void Print();
+
+	// 内存统计，bytes 为负表示释放
+	static void RecordMemory(int stage, int64_t bytes);
+
+	static int CurrentStage() { return currentStage; }
+
+	static void SetStage(int stage) { currentStage = stage; }
+
+private:
+	struct StageMemory
+	{
+		atomic<int64_t> allocated; // 累计分配
+		atomic<int64_t> live;      // 当前占用
+		atomic<int64_t> peak;      // 当前占用的最大值
+	};
+
+	static atomic<bool> enabled;
+	static thread_local int currentStage;
+	static StageMemory stages[STAGE_COUNT];
+	static atomic<int64_t> totalLive;
+	static atomic<int64_t> totalPeak;
+	static mutex counterLock;
+	static map<string, int64_t> counters;
+};
+
+// 划分内存统计阶段，作用域内当前线程的分配都记在 stage 名下
+class MemStage
+{
+public:
+	MemStage(int stage) : prev(Stats::CurrentStage()) { Stats::SetStage(stage); }
+
+	~MemStage() { Stats::SetStage(prev); }
+
+private:
+	int prev;
+};
+
+// 计数分配器：记下分配时所在的阶段，释放时从同一阶段扣除
+template<typename T>
+class CountingAllocator
+{
+public:
+	typedef T value_type;
+
+	CountingAllocator() : stage(Stats::CurrentStage()) {}
+
+	template<typename U>
+	CountingAllocator(const CountingAllocator<U>& other) : stage(other.stage) {}
+
+	T* allocate(size_t n)
+	{
+		Stats::RecordMemory(stage, n * sizeof(T));
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		Stats::RecordMemory(stage, -(int64_t)(n * sizeof(T)));
+		::operator delete(p);
+	}
+
+	template<typename U>
+	bool operator==(const CountingAllocator<U>& other) const { return true; }
+
+	template<typename U>
+	bool operator!=(const CountingAllocator<U>& other) const { return false; }
+
+	int stage;
+};
+
+template<typename T>
+using CountedVector = vector<T, CountingAllocator<T> >;